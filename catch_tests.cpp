@@ -8,9 +8,15 @@
 #define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
 #include "catch2/catch.hpp"
 
+#include <atomic>
+#include <cmath>
 #include <functional>
 #include <list>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
 #include <tuple>
 #include <type_traits>
 #include <utility>
@@ -1103,6 +1109,192 @@ TEST_CASE("A bound-lambda-based scope_guard calls the bound lambda exactly "
 }
 #endif
 
+/* --- bound arguments (make_scope_guard with arguments) --- */
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  void add(unsigned& c, unsigned n) noexcept { c += n; }
+
+  struct stateless_adder
+  {
+    void operator()(unsigned& c, unsigned n) const noexcept { c += n; }
+  };
+
+  void take(std::unique_ptr<unsigned>& p) noexcept { p.reset(); }
+
+  struct throwing_copy
+  {
+    throwing_copy() = default;
+    throwing_copy(const throwing_copy&) noexcept(false) {}
+    throwing_copy(throwing_copy&&) noexcept(false) {}
+  };
+
+  struct throwing_copy_taker
+  {
+    void operator()(throwing_copy&) const noexcept {}
+  };
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A function with bound arguments can be used to create a "
+          "scope_guard.")
+{
+  auto bound_count = 0u;
+  std::ignore = make_scope_guard(add, std::ref(bound_count), 2u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A scope_guard with bound arguments calls the function with those "
+          "arguments exactly once when leaving scope.")
+{
+  auto bound_count = 0u;
+
+  {
+    const auto guard = make_scope_guard(add, std::ref(bound_count), 2u);
+    REQUIRE_FALSE(bound_count);
+  }
+
+  REQUIRE(bound_count == 2u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A dismissed scope_guard with bound arguments does not execute its "
+          "callback at all.")
+{
+  auto bound_count = 0u;
+
+  {
+    auto guard = make_scope_guard(add, std::ref(bound_count), 2u);
+    guard.dismiss();
+  }
+
+  REQUIRE_FALSE(bound_count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A scope_guard with bound arguments holds copies of the arguments, "
+          "unless they are wrapped with std::ref.")
+{
+  auto bound_count = 0u;
+  auto n = 3u;
+
+  {
+    const auto guard = make_scope_guard(add, std::ref(bound_count), n);
+    n = 100u;
+  }
+
+  REQUIRE(bound_count == 3u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A scope_guard with bound arguments copies const lvalue arguments "
+          "into non-const values, also without std headers.")
+{
+  auto bound_count = 0u;
+  const auto n = 3u;
+  const auto amount = std::string{"abcd"};
+
+  {
+    const auto guard = make_scope_guard(add, std::ref(bound_count), n);
+    const auto guard2 = make_scope_guard(
+      [&bound_count](std::string& s) noexcept { bound_count += s.size(); },
+      amount);
+  }
+
+  REQUIRE(bound_count == 7u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A scope_guard with bound arguments can take ownership of move-only "
+          "arguments.")
+{
+  auto p = std::unique_ptr<unsigned>{new unsigned{42u}};
+  std::weak_ptr<unsigned> w;
+
+  {
+    auto sp = std::shared_ptr<unsigned>{new unsigned{42u}};
+    w = sp;
+    const auto guard = make_scope_guard([](std::shared_ptr<unsigned>& s)
+                                        noexcept { s.reset(); },
+                                        std::move(sp));
+    const auto guard2 = make_scope_guard(take, std::move(p));
+    REQUIRE_FALSE(p);
+    REQUIRE_FALSE(w.expired());
+  }
+
+  REQUIRE(w.expired());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A scope_guard with bound arguments can be moved, transferring the "
+          "call responsibility.")
+{
+  auto bound_count = 0u;
+
+  {
+    auto g1 = make_scope_guard(add, std::ref(bound_count), 1u);
+    {
+      auto g2 = std::move(g1);
+    }
+    REQUIRE(bound_count == 1u);
+  }
+
+  REQUIRE(bound_count == 1u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("Making a scope_guard with bound arguments is noexcept when "
+          "copying the arguments is, and preserves the noexcept "
+          "specification of the callback.")
+{
+  auto c = 0u;
+  static_assert(noexcept(make_scope_guard(add, std::ref(c), 1u)),
+                "making a guard with bound arguments should be noexcept");
+#ifdef __cpp_noexcept_function_type // otherwise noexcept lost with fun refs
+  static_assert(noexcept(std::declval<
+                  decltype(make_scope_guard(add, std::ref(c), 1u))::
+                  callback_type&>()()),
+                "bound callbacks should preserve noexcept");
+#endif
+  static_assert(!noexcept(make_scope_guard(throwing_copy_taker{},
+                                           std::declval<throwing_copy>())),
+                "argument copies that may throw should be reflected");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A scope_guard with bound arguments and an empty callback takes as "
+          "much space as a scope_guard with a lambda capturing the arguments.")
+{
+  auto c = 0u;
+  auto n = 1u;
+  const auto lambda_guard =
+    make_scope_guard([&c, n]() noexcept { stateless_adder{}(c, n); });
+
+  const auto functor_guard = make_scope_guard(stateless_adder{},
+                                              std::ref(c), n);
+  REQUIRE(sizeof(functor_guard) == sizeof(lambda_guard));
+
+  const auto captureless_guard = make_scope_guard(
+    [](unsigned& counter, unsigned amount) noexcept { counter += amount; },
+    std::ref(c), n);
+  REQUIRE(sizeof(captureless_guard) == sizeof(lambda_guard));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A scope_guard with bound arguments and a plain function takes no "
+          "more space than a scope_guard with a lambda capturing the arguments "
+          "plus a reference to the function.")
+{
+  auto c = 0u;
+  auto n = 1u;
+  const auto lambda_guard =
+    make_scope_guard([&c, n]() noexcept { add(c, n); });
+
+  const auto bound_guard = make_scope_guard(add, std::ref(c), n);
+  REQUIRE(sizeof(bound_guard) <= sizeof(lambda_guard) + sizeof(&add));
+}
+
 /* --- custom functors --- */
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1771,185 +1963,1483 @@ TEST_CASE("When deducing make_scope_guard's callback type, and when noexcept "
 }
 #endif
 
-/* --- miscellaneous --- */
-
 ////////////////////////////////////////////////////////////////////////////////
-TEST_CASE("Multiple independent scope_guards do not interfere with each "
-          "other - each of their post-conditions hold.")
+namespace
 {
-  auto a = 0u;
-  auto b = 0u;
-  auto c = 0u;
+  template<typename T, typename... Args>
+  auto bound_sfinae_tester_impl(tag_prefered_overload&& /*ignored*/, T&& t,
+                                Args&&... args)
+  -> decltype(make_scope_guard(std::forward<T>(t),
+                               std::forward<Args>(args)...),
+              std::declval<void>())
+  {
+    std::ignore = make_scope_guard(std::forward<T>(t),
+                                   std::forward<Args>(args)...);
+  }
 
+  template<typename... Ignored>
+  void bound_sfinae_tester_impl(int&& /* worse match, so 2nd choice */,
+                                Ignored&&... /*ignored*/)
   {
-    auto guard_a = make_scope_guard([&a]() noexcept { incc(a); });
-    REQUIRE_FALSE(a);
-    REQUIRE_FALSE(b);
-    REQUIRE_FALSE(c);
+    std::ignore = make_scope_guard(inc);
   }
-  REQUIRE(a == 1u);
-  REQUIRE_FALSE(b);
-  REQUIRE_FALSE(c);
 
+  template<typename T, typename... Args>
+  void bound_sfinae_tester(T&& t, Args&&... args)
   {
-    auto guard_b = make_scope_guard([&b]() noexcept { incc(b); });
-    auto guard_c = make_scope_guard([&c]() noexcept { incc(c); });
-    REQUIRE(a == 1u);
-    REQUIRE_FALSE(b);
-    REQUIRE_FALSE(c);
+    bound_sfinae_tester_impl(tag_prefered_overload{}, std::forward<T>(t),
+                             std::forward<Args>(args)...); // see sfinae_tester
   }
-  REQUIRE(a == 1u);
-  REQUIRE(b == 1u);
-  REQUIRE(c == 1u);
-}
+} // namespace
 
 ////////////////////////////////////////////////////////////////////////////////
-TEST_CASE("Test nested scopes")
+TEST_CASE("When deducing make_scope_guard's types with bound arguments, a "
+          "substitution failure caused by arguments that do not suit the "
+          "callable can be recovered from without a compilation error")
 {
-  auto lvl0_count  = 0u;
-  auto lvl1_count  = 0u;
-  auto lvl2a_count = 0u;
-  auto lvl2b_count = 0u;
-  auto lvl3a_count = 0u;
-  auto lvl3b_count = 0u;
-  auto lvl3c_count = 0u;
-
-  const auto lvl0_guard =
-    make_scope_guard([&lvl0_count]() noexcept { incc(lvl0_count); });
-  REQUIRE_FALSE(lvl0_count);
-
-  {
-    const auto lvl1_guard =
-      make_scope_guard([&lvl1_count]() noexcept { incc(lvl1_count); });
-
-    {
-      const auto lvl2a_guard =
-        make_scope_guard([&lvl2a_count]() noexcept { incc(lvl2a_count); });
-      REQUIRE_FALSE(lvl2a_count);
-
-      {
-        const auto lvl3a_guard =
-          make_scope_guard([&lvl3a_count]() noexcept { incc(lvl3a_count); });
-        REQUIRE_FALSE(lvl3a_count);
-      }
+  reset();
 
-      REQUIRE(lvl3a_count == 1);
-      REQUIRE_FALSE(lvl2a_count);
-    }
+  auto c = 0u;
+  bound_sfinae_tester(incc, std::ref(c)); // fits
+  REQUIRE(c == 1u);
+  REQUIRE_FALSE(count);
 
-    REQUIRE(lvl2a_count == 1);
-    REQUIRE_FALSE(lvl1_count);
-    REQUIRE_FALSE(lvl0_count);
+  bound_sfinae_tester(incc, "rubbish"); // wrong argument type
+  REQUIRE(count == 1u);
 
-    {
-      const auto lvl2b_guard =
-        make_scope_guard([&lvl2b_count]() noexcept { incc(lvl2b_count); });
-      REQUIRE_FALSE(lvl2b_count);
+  bound_sfinae_tester(incc, std::ref(c), 2); // too many arguments
+  REQUIRE(count == 2u);
 
-      {
-        const auto lvl3b_guard =
-          make_scope_guard([&lvl3b_count]() noexcept { incc(lvl3b_count); });
-        REQUIRE_FALSE(lvl3b_count);
+  bound_sfinae_tester(123, 2); // not callable
+  REQUIRE(count == 3u);
 
-        const auto lvl3c_guard =
-          make_scope_guard([&lvl3c_count]() noexcept { incc(lvl3c_count); });
-        REQUIRE_FALSE(lvl3c_count);
-      }
+  bound_sfinae_tester([](int i) noexcept { return i; }, 2); // returns int
+  REQUIRE(count == 4u);
+}
 
-      REQUIRE(lvl3b_count == 1);
-      REQUIRE(lvl3c_count == 1);
-      REQUIRE_FALSE(lvl2b_count);
+/* --- fallible callbacks --- */
 
-    }
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  int fallible_count = 0;
+  int fallible(int err) noexcept { ++fallible_count; return err; }
 
-    REQUIRE(lvl2b_count == 1);
-    REQUIRE_FALSE(lvl1_count);
-    REQUIRE_FALSE(lvl0_count);
+  template<typename T, typename Aggregator>
+  auto fallible_sfinae_tester_impl(T&& t, Aggregator& errors,
+                                   tag_prefered_overload&& /*ignored*/)
+  -> decltype(make_fallible_scope_guard(std::forward<T>(t), errors),
+              std::declval<void>())
+  {
+    std::ignore = make_fallible_scope_guard(std::forward<T>(t), errors);
+  }
 
+  template<typename T, typename Aggregator>
+  void fallible_sfinae_tester_impl(T&& /*ignored*/, Aggregator& errors,
+                                   ... /* less specific, so 2nd choice */)
+  {
+    errors.record(-1);
   }
 
-  REQUIRE(lvl1_count  == 1);
-  REQUIRE(lvl2a_count == 1);
-  REQUIRE(lvl2b_count == 1);
-  REQUIRE(lvl3a_count == 1);
-  REQUIRE(lvl3b_count == 1);
-  REQUIRE(lvl3c_count == 1);
-  REQUIRE_FALSE(lvl0_count);
+  template<typename T, typename Aggregator>
+  void fallible_sfinae_tester(T&& t, Aggregator& errors)
+  {
+    fallible_sfinae_tester_impl(std::forward<T>(t), errors,
+                                tag_prefered_overload{}); // see sfinae_tester
+  }
+} // namespace
 
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A fallible callback can be used to create a scope_guard that "
+          "records errors in an error_aggregator.")
+{
+  error_aggregator<int, 4> errors;
+  std::ignore = make_fallible_scope_guard([]() noexcept { return 0; }, errors);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-TEST_CASE("Dismissing a scope_guard multiple times is the same as dismissing it"
-          "only once")
+TEST_CASE("A fallible-callback-based scope_guard executes the callback exactly "
+          "once when leaving scope and records only failures.")
 {
-  reset();
+  fallible_count = 0;
+  error_aggregator<int, 4> errors;
 
-  for(auto i = 0; i < 100; ++i)
   {
-    {
-      auto guard = make_scope_guard(inc);
-      for(int c = 0; c <= i; ++c)
-        guard.dismiss();
-      REQUIRE_FALSE(count);
-    }
-
-    REQUIRE_FALSE(count);
+    const auto g1 =
+      make_fallible_scope_guard([]() noexcept { return fallible(0); }, errors);
+    const auto g2 =
+      make_fallible_scope_guard([]() noexcept { return fallible(42); },
+                                errors);
+    REQUIRE_FALSE(fallible_count);
+    REQUIRE_FALSE(errors.failures());
   }
+
+  REQUIRE(fallible_count == 2);
+  REQUIRE(errors.failures() == 1u);
+  REQUIRE(errors.size() == 1u);
+  REQUIRE(errors[0] == 42);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-TEST_CASE("scope_guards execute their callback exactly once when leaving "
-          "scope due to an exception")
+TEST_CASE("A dismissed fallible-callback-based scope_guard does not execute "
+          "its callback nor record anything.")
 {
-  reset();
-  auto countl = 0u;
+  fallible_count = 0;
+  error_aggregator<int, 4> errors;
 
-  try
-  {
-    const auto guard = make_scope_guard(inc);
-    const auto guardl = make_scope_guard([&countl]() noexcept { ++countl; });
-    throw "foo";
-  }
-  catch(...)
   {
-    REQUIRE(count == 1u);
-    REQUIRE(countl == 1u);
+    auto guard =
+      make_fallible_scope_guard([]() noexcept { return fallible(1); }, errors);
+    guard.dismiss();
   }
+
+  REQUIRE_FALSE(fallible_count);
+  REQUIRE_FALSE(errors.failures());
+  REQUIRE(errors.begin() == errors.end());
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-TEST_CASE("dismissed scope_guards do not execute their callback when leaving "
-          "scope due to an exception")
+TEST_CASE("An error_aggregator keeps the first errors that fit, in the order "
+          "they occur, but counts all failures.")
 {
-  reset();
-  auto countl = 0u;
+  error_aggregator<int, 2> errors;
 
-  try
   {
-    auto guard = make_scope_guard(inc);
-    auto guardl = make_scope_guard([&countl]() noexcept { ++countl; });
+    const auto g1 =
+      make_fallible_scope_guard([]() noexcept { return fallible(1); }, errors);
+    const auto g2 =
+      make_fallible_scope_guard([]() noexcept { return fallible(2); }, errors);
+    const auto g3 =
+      make_fallible_scope_guard([]() noexcept { return fallible(3); }, errors);
+  } // reverse order of creation
 
-    guard.dismiss();
-    guardl.dismiss();
+  REQUIRE(errors.failures() == 3u);
+  REQUIRE(errors.size() == 2u);
+  REQUIRE(errors[0] == 3);
+  REQUIRE(errors[1] == 2);
+  REQUIRE(errors.end() - errors.begin() == 2);
+
+  errors.clear();
+  REQUIRE_FALSE(errors.failures());
+  REQUIRE_FALSE(errors.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A fallible callback can return a std::error_code, which is recorded "
+          "when it converts to true.")
+{
+  error_aggregator<std::error_code, 2> errors;
+  const auto bad = std::make_error_code(std::errc::io_error);
 
-    throw "foo";
-  }
-  catch(...)
   {
-    REQUIRE_FALSE(count);
-    REQUIRE_FALSE(countl);
+    const auto g1 = make_fallible_scope_guard(
+      []() noexcept { return std::error_code{}; }, errors);
+    const auto g2 = make_fallible_scope_guard(
+      [bad]() noexcept { return bad; }, errors);
   }
+
+  REQUIRE(errors.failures() == 1u);
+  REQUIRE(errors[0] == bad);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-namespace
+TEST_CASE("A fallible-callback-based scope_guard can be moved, transferring "
+          "the responsibility to record errors.")
 {
-  unsigned returning(unsigned ret)
+  error_aggregator<int, 2> errors;
+
   {
-    if(ret)
+    auto g1 =
+      make_fallible_scope_guard([]() noexcept { return fallible(7); }, errors);
     {
-      const auto guard = make_scope_guard(inc);
-      return ret;
+      auto g2 = std::move(g1);
+    }
+    REQUIRE(errors.failures() == 1u);
+  }
+
+  REQUIRE(errors.failures() == 1u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("When deducing make_fallible_scope_guard's callback type, a "
+          "substitution failure caused by a callable whose result cannot be "
+          "recorded can be recovered from without a compilation error")
+{
+  error_aggregator<int, 4> errors;
+
+  fallible_sfinae_tester([]() noexcept { return 0; }, errors);
+  REQUIRE_FALSE(errors.failures());
+
+  fallible_sfinae_tester(noop, errors); // void return
+  REQUIRE(errors.failures() == 1u);
+
+  fallible_sfinae_tester([]() noexcept { return "rubbish"; }, errors);
+  REQUIRE(errors.failures() == 2u);
+
+  fallible_sfinae_tester(123, errors); // not callable
+  REQUIRE(errors.failures() == 3u);
+}
+
+#ifdef SG_REQUIRE_NOEXCEPT
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("When deducing make_fallible_scope_guard's callback type, and when "
+          "noexcept is required, a substitution failure caused by a callable "
+          "that is not noexcept can be recovered-from without a compilation "
+          "error")
+{
+  error_aggregator<int, 4> errors;
+  fallible_sfinae_tester([](){ return 0; }, errors); // not marked noexcept
+  REQUIRE(errors.failures() == 1u);
+}
+#endif
+
+/* --- guards that restore variables --- */
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  struct padded
+  {
+    char c;
+    double d;
+  };
+
+  class tail_padded // not POD, so derived classes may reuse its tail padding
+  {
+  public:
+    explicit tail_padded(int i) : m_i{i} {}
+    int get() const { return m_i; }
+
+  private:
+    int m_i;
+    char m_c = 0;
+  };
+
+  struct tail_reuser : tail_padded
+  {
+    tail_reuser(int i, char c) : tail_padded{i}, m_d{c} {}
+    char m_d;
+  };
+
+  template<typename T>
+  auto restore_sfinae_tester_impl(T& t, tag_prefered_overload&& /*ignored*/)
+  -> decltype(make_restore_guard(t), bool{})
+  {
+    std::ignore = make_restore_guard(t);
+    return true;
+  }
+
+  template<typename T>
+  bool restore_sfinae_tester_impl(T& /*ignored*/,
+                                  ... /* less specific, so 2nd choice */)
+  {
+    return false;
+  }
+
+  template<typename T>
+  bool restore_sfinae_tester(T& t)
+  {
+    return restore_sfinae_tester_impl(t, tag_prefered_overload{}); /*
+                                                        see sfinae_tester */
+  }
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A restore guard restores the variable's original value when "
+          "leaving scope.")
+{
+  auto i = 1;
+  {
+    const auto guard = make_restore_guard(i);
+    i = 2;
+    REQUIRE(i == 2);
+  }
+
+  REQUIRE(i == 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A restore guard leaves an unchanged variable with its value.")
+{
+  auto i = 1;
+  {
+    const auto guard = make_restore_guard(i);
+  }
+
+  REQUIRE(i == 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A dismissed restore guard does not restore the variable.")
+{
+  auto i = 1;
+  {
+    auto guard = make_restore_guard(i);
+    i = 2;
+    guard.dismiss();
+  }
+
+  REQUIRE(i == 2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A restore guard restores trivially copyable types larger than a "
+          "register.")
+{
+  auto p = padded{'a', 1.5};
+  {
+    const auto guard = make_restore_guard(p);
+    p = padded{'b', 2.5};
+  }
+
+  REQUIRE(p.c == 'a');
+  REQUIRE(p.d == 1.5);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A restore guard on a base class subobject leaves the members of the "
+          "derived class alone, even when they live in the base's padding.")
+{
+  auto d = tail_reuser{1, 7};
+  {
+    auto& b = static_cast<tail_padded&>(d);
+    const auto guard = make_restore_guard(b);
+    b = tail_padded{2};
+    d.m_d = 9;
+  }
+
+  REQUIRE(d.get() == 1);
+  REQUIRE(d.m_d == 9);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A restore guard restores floating point values that compare equal "
+          "to the saved one.")
+{
+  auto x = 0.0;
+  {
+    const auto guard = make_restore_guard(x);
+    x = -0.0;
+  }
+
+  REQUIRE_FALSE(std::signbit(x));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A restore guard restores types that are not trivially copyable.")
+{
+  auto s = std::string{"original"};
+  {
+    const auto guard = make_restore_guard(s);
+    s = "changed";
+  }
+
+  REQUIRE(s == "original");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("An override guard assigns the new value and restores the original "
+          "one when leaving scope.")
+{
+  auto s = std::string{"original"};
+  {
+    const auto guard = make_override_guard(s, "override");
+    REQUIRE(s == "override");
+  }
+
+  REQUIRE(s == "original");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A restore guard can be moved, transferring the responsibility to "
+          "restore.")
+{
+  auto i = 1;
+  {
+    auto g1 = make_override_guard(i, 2);
+    {
+      auto g2 = std::move(g1);
+      REQUIRE(i == 2);
+    }
+    REQUIRE(i == 1);
+    i = 3;
+  }
+
+  REQUIRE(i == 3);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A restore guard is noexcept when the variable's type can be copied "
+          "without throwing.")
+{
+  auto i = 1;
+  auto s = std::string{};
+  static_assert(noexcept(make_restore_guard(i)), "");
+  static_assert(noexcept(make_override_guard(i, 2)), "");
+  static_assert(!noexcept(make_restore_guard(s)), "");
+  static_assert(!noexcept(make_override_guard(s, "")), "");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A restore guard takes no more space than an equivalent "
+          "lambda-based scope_guard.")
+{
+  auto i = 1;
+  const auto old = i;
+  const auto restore_guard = make_restore_guard(i);
+  const auto copy_guard = make_scope_guard([&i, old]() noexcept { i = old; });
+  const auto ref_guard = make_scope_guard([&i, &old]() noexcept { i = old; });
+
+  REQUIRE(sizeof(restore_guard) <= sizeof(copy_guard));
+  REQUIRE(sizeof(restore_guard) < sizeof(ref_guard) + sizeof(old)); /*
+                      the usual pattern needs the saved copy on the side too */
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("When deducing make_restore_guard's variable type, a substitution "
+          "failure caused by a variable that cannot be assigned can be "
+          "recovered from without a compilation error")
+{
+  auto i = 1;
+  const auto ci = 1;
+  REQUIRE(restore_sfinae_tester(i));
+  REQUIRE_FALSE(restore_sfinae_tester(ci));
+}
+
+#ifdef SG_REQUIRE_NOEXCEPT
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("When deducing make_restore_guard's variable type, and when noexcept "
+          "is required, a substitution failure caused by a variable whose "
+          "move assignment is not noexcept can be recovered-from without a "
+          "compilation error")
+{
+  struct throwing_move_assign
+  {
+    throwing_move_assign() = default;
+    throwing_move_assign(const throwing_move_assign&) = default;
+    throwing_move_assign& operator=(throwing_move_assign&&) { return *this; }
+    throwing_move_assign& operator=(const throwing_move_assign&) = default;
+  } x;
+
+  REQUIRE_FALSE(restore_sfinae_tester(x));
+}
+#endif
+
+/* --- guards that unlock around slow work --- */
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  struct lockable
+  {
+    void lock() noexcept { ++locks; locked = true; }
+    void unlock() noexcept { ++unlocks; locked = false; }
+
+    bool locked = true;
+    unsigned locks = 0u;
+    unsigned unlocks = 0u;
+  };
+
+  struct throwing_unlock_lockable
+  {
+    void lock() {}
+    void unlock() {}
+  };
+
+  template<typename T>
+  auto unlock_sfinae_tester_impl(T& t, tag_prefered_overload&& /*ignored*/)
+  -> decltype(make_unlock_guard(t), bool{})
+  {
+    std::ignore = make_unlock_guard(t);
+    return true;
+  }
+
+  template<typename T>
+  bool unlock_sfinae_tester_impl(T& /*ignored*/,
+                                 ... /* less specific, so 2nd choice */)
+  {
+    return false;
+  }
+
+  template<typename T>
+  bool unlock_sfinae_tester(T& t)
+  {
+    return unlock_sfinae_tester_impl(t, tag_prefered_overload{}); /*
+                                                        see sfinae_tester */
+  }
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("An unlock guard unlocks on creation and locks again exactly once "
+          "when leaving scope.")
+{
+  lockable l;
+  {
+    const auto guard = make_unlock_guard(l);
+    REQUIRE_FALSE(l.locked);
+    REQUIRE(l.unlocks == 1u);
+    REQUIRE_FALSE(l.locks);
+  }
+
+  REQUIRE(l.locked);
+  REQUIRE(l.locks == 1u);
+  REQUIRE(l.unlocks == 1u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("An unlock guard locks again when leaving scope due to an "
+          "exception.")
+{
+  lockable l;
+  try
+  {
+    const auto guard = make_unlock_guard(l);
+    throw std::runtime_error{"slow work failed"};
+  }
+  catch(const std::runtime_error&)
+  {
+    REQUIRE(l.locked);
+  }
+
+  REQUIRE(l.locks == 1u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A dismissed unlock guard on a std::unique_lock does not lock again, "
+          "and the unique_lock knows not to unlock.")
+{
+  lockable l;
+  {
+    std::unique_lock<lockable> lock{l, std::adopt_lock};
+    {
+      auto guard = make_unlock_guard(lock);
+      guard.dismiss();
+    }
+    REQUIRE_FALSE(lock.owns_lock());
+  }
+
+  REQUIRE_FALSE(l.locked);
+  REQUIRE_FALSE(l.locks);
+  REQUIRE(l.unlocks == 1u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("An unlock guard works with standard lock wrappers.")
+{
+  lockable l;
+  {
+    std::unique_lock<lockable> lock{l, std::adopt_lock};
+    {
+      const auto guard = make_unlock_guard(lock);
+      REQUIRE_FALSE(lock.owns_lock());
+    }
+    REQUIRE(lock.owns_lock());
+  }
+
+  REQUIRE_FALSE(l.locked);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("Making an unlock guard is noexcept when unlocking is.")
+{
+  lockable l;
+  throwing_unlock_lockable tl;
+  static_assert(noexcept(make_unlock_guard(l)), "");
+  static_assert(!noexcept(make_unlock_guard(tl)), "");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("When deducing make_unlock_guard's lockable type, a substitution "
+          "failure caused by a type that cannot be locked and unlocked can be "
+          "recovered from without a compilation error")
+{
+  lockable l;
+  auto i = 1;
+  REQUIRE(unlock_sfinae_tester(l));
+  REQUIRE_FALSE(unlock_sfinae_tester(i));
+}
+
+/* --- guards that batch counter updates --- */
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  struct counting_counter
+  {
+    long fetch_add(long delta) noexcept
+    {
+      ++updates;
+      return (value += delta) - delta;
+    }
+
+    long value = 0;
+    unsigned updates = 0u;
+  };
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A batch guard publishes the accumulated delta with a single update "
+          "when leaving scope.")
+{
+  counting_counter counter;
+  {
+    auto delta = 0l;
+    const auto guard = make_batch_guard(counter, delta);
+    for(auto i = 0; i < 100; ++i)
+      ++delta;
+
+    REQUIRE_FALSE(counter.value);
+  }
+
+  REQUIRE(counter.value == 100);
+  REQUIRE(counter.updates == 1u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A batch guard does not touch the counter when there is nothing to "
+          "publish.")
+{
+  counting_counter counter;
+  {
+    auto delta = 0l;
+    const auto guard = make_batch_guard(counter, delta);
+  }
+
+  REQUIRE_FALSE(counter.updates);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A batch guard publishes into std::atomic, also when leaving scope "
+          "due to an exception.")
+{
+  std::atomic<unsigned> counter{1u};
+  try
+  {
+    auto delta = 0u;
+    const auto guard = make_batch_guard(counter, delta);
+    delta += 2u;
+    throw std::runtime_error{"boom"};
+  }
+  catch(const std::runtime_error&)
+  {}
+
+  REQUIRE(counter.load() == 3u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A dismissed batch guard does not publish.")
+{
+  counting_counter counter;
+  {
+    auto delta = 5l;
+    auto guard = make_batch_guard(counter, delta);
+    guard.dismiss();
+  }
+
+  REQUIRE_FALSE(counter.updates);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A batch guard for std::atomic is nothrow.")
+{
+  std::atomic<long> counter{0};
+  auto delta = 0l;
+  using callback = decltype(make_batch_guard(counter, delta))::callback_type;
+  static_assert(noexcept(make_batch_guard(counter, delta)), "");
+  static_assert(noexcept(std::declval<callback&>()()), "");
+}
+
+/* --- guards that act around outermost scopes only --- */
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  unsigned enters = 0u;
+  unsigned leaves = 0u;
+  void enter() { ++enters; }
+  void leave() noexcept { ++leaves; }
+  void throwing_enter() { throw std::runtime_error{"cannot enter"}; }
+
+  void nested_region(unsigned& depth, int levels)
+  {
+    const auto guard = make_outermost_guard(depth, enter, leave);
+    REQUIRE(enters == leaves + 1u); // inside, entered once more than left
+    if(levels)
+      nested_region(depth, levels - 1);
+  }
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("An outermost guard enters and leaves only around the outermost of "
+          "nested scopes.")
+{
+  enters = leaves = 0u;
+  auto depth = 0u;
+
+  nested_region(depth, 5);
+  REQUIRE(enters == 1u);
+  REQUIRE(leaves == 1u);
+  REQUIRE_FALSE(depth);
+
+  nested_region(depth, 0);
+  REQUIRE(enters == 2u);
+  REQUIRE(leaves == 2u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("An outermost guard whose enter action throws leaves the depth "
+          "untouched.")
+{
+  enters = leaves = 0u;
+  auto depth = 0u;
+
+  REQUIRE_THROWS_AS(make_outermost_guard(depth, throwing_enter, leave),
+                    std::runtime_error);
+  REQUIRE_FALSE(depth);
+  REQUIRE_FALSE(leaves);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A guard made within the enter action of an outermost guard is an "
+          "inner one, so it neither enters nor leaves.")
+{
+  enters = leaves = 0u;
+  auto depth = 0u;
+  {
+    const auto guard = make_outermost_guard(depth, [&depth]()
+    {
+      enter();
+      const auto inner = make_outermost_guard(depth, enter, leave);
+      REQUIRE(depth == 2u);
+    }, leave);
+
+    REQUIRE(enters == 1u);
+    REQUIRE_FALSE(leaves);
+    REQUIRE(depth == 1u);
+  }
+
+  REQUIRE(leaves == 1u);
+  REQUIRE_FALSE(depth);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("An outermost guard can be moved, transferring the responsibility to "
+          "leave.")
+{
+  enters = leaves = 0u;
+  auto depth = 0u;
+  {
+    auto g1 = make_outermost_guard(depth, enter, leave);
+    {
+      auto g2 = std::move(g1);
+      REQUIRE(depth == 1u);
+    }
+    REQUIRE(leaves == 1u);
+  }
+
+  REQUIRE(leaves == 1u);
+  REQUIRE_FALSE(depth);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A dismissed inner guard gives its depth back, so that the outermost "
+          "guard still leaves.")
+{
+  enters = leaves = 0u;
+  auto depth = 0u;
+  {
+    const auto outer = make_outermost_guard(depth, enter, leave);
+    {
+      auto inner = make_outermost_guard(depth, enter, leave);
+      inner.dismiss();
+    }
+    REQUIRE(depth == 1u);
+  }
+
+  REQUIRE(enters == 1u);
+  REQUIRE(leaves == 1u);
+  REQUIRE_FALSE(depth);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A dismissed outermost guard gives its depth back without leaving, "
+          "so that the next outermost guard enters again.")
+{
+  enters = leaves = 0u;
+  auto depth = 0u;
+  {
+    auto guard = make_outermost_guard(depth, enter, leave);
+    guard.dismiss();
+  }
+
+  REQUIRE_FALSE(depth);
+  REQUIRE_FALSE(leaves);
+
+  {
+    const auto guard = make_outermost_guard(depth, enter, leave);
+    REQUIRE(enters == 2u);
+  }
+  REQUIRE(leaves == 1u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A moved and then dismissed outermost guard gives its depth back "
+          "only once.")
+{
+  enters = leaves = 0u;
+  auto depth = 0u;
+  {
+    const auto outer = make_outermost_guard(depth, enter, leave);
+    {
+      auto g1 = make_outermost_guard(depth, enter, leave);
+      auto g2 = std::move(g1);
+      g2.dismiss();
+    }
+    REQUIRE(depth == 1u);
+  }
+
+  REQUIRE(leaves == 1u);
+  REQUIRE_FALSE(depth);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("An outermost guard with stateless actions takes no more space than "
+          "a reference to the depth plus the activity flag.")
+{
+  auto depth = 0u;
+  const auto guard =
+    make_outermost_guard(depth, []() noexcept {}, []() noexcept {});
+  REQUIRE(sizeof(guard) <= 2 * sizeof(unsigned*));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("Making an outermost guard is noexcept when entering is.")
+{
+  auto depth = 0u;
+  const auto nothrow_enter = []() noexcept {};
+  static_assert(noexcept(make_outermost_guard(depth, nothrow_enter, leave)),
+                "");
+  static_assert(!noexcept(make_outermost_guard(depth, enter, leave)), "");
+}
+
+/* --- guards that invalidate by generation --- */
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  struct stamped_entry
+  {
+    int value;
+    unsigned generation;
+  };
+
+  template<typename T>
+  auto generation_sfinae_tester(T& t) -> decltype(make_generation_guard(t),
+                                                  bool{})
+  {
+    return true;
+  }
+
+  template<typename T>
+  bool generation_sfinae_tester(const T&) // const T& to avoid ambiguity
+  {
+    return false;
+  }
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A generation guard marks the generation under update (odd) while "
+          "in scope and bumps it again when leaving scope, invalidating all "
+          "entries stamped before.")
+{
+  auto generation = 0u;
+  stamped_entry entries[] = {{1, generation}, {2, generation}, {3, generation}};
+  {
+    const auto guard = make_generation_guard(generation);
+    for(auto& e : entries)
+      e.value *= 10;
+
+    REQUIRE(generation == 1u);
+  }
+
+  REQUIRE(generation == 2u);
+  for(const auto& e : entries)
+    REQUIRE(e.generation != generation);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A dismissed generation guard restores the generation as it was "
+          "before the scope.")
+{
+  auto generation = 6u;
+  {
+    auto guard = make_generation_guard(generation);
+    REQUIRE(generation == 7u);
+    guard.dismiss();
+    REQUIRE(generation == 7u); // still under update until the scope ends
+  }
+
+  REQUIRE(generation == 6u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A moved generation guard bumps or restores the generation only "
+          "once.")
+{
+  auto generation = 0u;
+  {
+    auto guard = make_generation_guard(generation);
+    {
+      const auto moved = std::move(guard);
+    }
+    REQUIRE(generation == 2u);
+  }
+  REQUIRE(generation == 2u);
+
+  {
+    auto guard = make_generation_guard(generation);
+    guard.dismiss();
+    {
+      const auto moved = std::move(guard);
+    }
+    REQUIRE(generation == 2u);
+  }
+  REQUIRE(generation == 2u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A generation guard bumps std::atomic, also when leaving scope due "
+          "to an exception.")
+{
+  std::atomic<unsigned long> generation{40u};
+  try
+  {
+    const auto guard = make_generation_guard(generation);
+    REQUIRE(generation.load() == 41u);
+    throw std::runtime_error{"boom"};
+  }
+  catch(const std::runtime_error&)
+  {}
+
+  REQUIRE(generation.load() == 42u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A generation guard takes no more space than a reference to the "
+          "generation plus the activity flag.")
+{
+  auto generation = 0u;
+  const auto guard = make_generation_guard(generation);
+  REQUIRE(sizeof(guard) <= 2 * sizeof(unsigned*));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A generation guard for std::atomic is nothrow.")
+{
+  std::atomic<unsigned> generation{0u};
+  using callback = decltype(make_generation_guard(generation))::callback_type;
+  static_assert(noexcept(make_generation_guard(generation)), "");
+  static_assert(noexcept(std::declval<callback&>()()), "");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("When deducing make_generation_guard's generation type, a "
+          "substitution failure caused by a type that cannot be incremented "
+          "and decremented can be recovered from without a compilation error")
+{
+  auto generation = 0u;
+  auto not_a_generation = std::string{};
+  REQUIRE(generation_sfinae_tester(generation));
+  REQUIRE_FALSE(generation_sfinae_tester(not_a_generation));
+}
+
+/* --- request-scoped cleanup contexts --- */
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  std::string cleanup_trace;
+
+  void trace(const char* what) noexcept
+  {
+    try { cleanup_trace += what; } catch(...) {}
+  }
+
+  void deep_callee(int depth) noexcept
+  {
+    if(depth)
+      deep_callee(depth - 1);
+    else
+      REQUIRE(defer_to_request([]() noexcept { trace("deep"); }));
+  }
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("Deferring to a request without a cleanup context fails and drops "
+          "the callback.")
+{
+  cleanup_trace.clear();
+  REQUIRE_FALSE(defer_to_request([]() noexcept { trace("x"); }));
+  REQUIRE(cleanup_trace.empty());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("Cleanups deferred to a request run when the cleanup context ends, "
+          "not when the deferring scope ends, last first.")
+{
+  cleanup_trace.clear();
+  {
+    cleanup_context<256> ctx;
+    {
+      REQUIRE(defer_to_request([]() noexcept { trace("a"); }));
+      REQUIRE(defer_to_request([]() noexcept { trace("b"); }));
+    }
+    deep_callee(10);
+    REQUIRE(cleanup_trace.empty());
+  }
+
+  REQUIRE(cleanup_trace == "deepba");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("Deferring to a request fails and drops the callback when the cleanup "
+          "context runs out of room, leaving previous cleanups untouched.")
+{
+  cleanup_trace.clear();
+  {
+    cleanup_context<2 * sizeof(void*)> ctx; // too little for any cleanup
+    REQUIRE_FALSE(defer_to_request([]() noexcept { trace("x"); }));
+  }
+  REQUIRE(cleanup_trace.empty());
+
+  {
+    cleanup_context<256> ctx;
+    auto deferred = 0u;
+    while(defer_to_request([]() noexcept { trace("y"); }))
+      ++deferred;
+
+    REQUIRE(deferred > 0u);
+    REQUIRE(cleanup_trace.empty());
+    cleanup_trace.reserve(deferred);
+  }
+
+  REQUIRE(cleanup_trace.size() > 0u);
+  REQUIRE(cleanup_trace.find_first_not_of('y') == std::string::npos);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A nested cleanup context takes cleanups while it lives and then "
+          "gives way to the enclosing one.")
+{
+  cleanup_trace.clear();
+  {
+    cleanup_context<256> outer;
+    REQUIRE(defer_to_request([]() noexcept { trace("1"); }));
+    {
+      cleanup_context<256> inner;
+      REQUIRE(defer_to_request([]() noexcept { trace("2"); }));
+    }
+    REQUIRE(cleanup_trace == "2");
+    REQUIRE(defer_to_request([]() noexcept { trace("3"); }));
+  }
+
+  REQUIRE(cleanup_trace == "231");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("Cleanups that defer more cleanups while running reach the "
+          "enclosing cleanup context.")
+{
+  cleanup_trace.clear();
+  {
+    cleanup_context<256> outer;
+    {
+      cleanup_context<256> inner;
+      REQUIRE(defer_to_request([]() noexcept
+      {
+        trace("i");
+        REQUIRE(defer_to_request([]() noexcept { trace("o"); }));
+      }));
+    }
+    REQUIRE(cleanup_trace == "i");
+  }
+
+  REQUIRE(cleanup_trace == "io");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("Stateful cleanups deferred to a request are destroyed after "
+          "running.")
+{
+  auto shared = std::make_shared<int>(0);
+  {
+    cleanup_context<256> ctx;
+    auto copy = shared;
+    REQUIRE(defer_to_request([copy]() noexcept { ++*copy; }));
+    REQUIRE(shared.use_count() == 3);
+  }
+
+  REQUIRE(*shared == 1);
+  REQUIRE(shared.use_count() == 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A dismissed cleanup context drops its deferred cleanups without "
+          "running them, and destroys those that are stateful.")
+{
+  cleanup_trace.clear();
+  auto shared = std::make_shared<int>(0);
+  {
+    cleanup_context<256> ctx;
+    REQUIRE(defer_to_request([]() noexcept { trace("a"); }));
+    auto copy = shared;
+    REQUIRE(defer_to_request([copy]() noexcept { ++*copy; }));
+    copy.reset();
+
+    ctx.dismiss();
+    REQUIRE(shared.use_count() == 1);
+  }
+
+  REQUIRE(cleanup_trace.empty());
+  REQUIRE_FALSE(*shared);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A dismissed cleanup context takes and runs new cleanups, with all "
+          "of its room available again.")
+{
+  cleanup_trace.clear();
+  {
+    cleanup_context<256> ctx;
+    auto deferred = 0u;
+    while(defer_to_request([]() noexcept { trace("x"); }))
+      ++deferred;
+
+    ctx.dismiss();
+    for(auto i = 0u; i < deferred; ++i)
+      REQUIRE(defer_to_request([]() noexcept { trace("y"); }));
+  }
+
+  REQUIRE(cleanup_trace.find_first_not_of('y') == std::string::npos);
+  REQUIRE(cleanup_trace.size() > 0u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("Deferring to a request is noexcept when the callback can be copied "
+          "without throwing.")
+{
+  const auto s = std::string{};
+  const auto lambda = [s]() noexcept {};
+  static_assert(noexcept(defer_to_request(noop)), "");
+  static_assert(!noexcept(defer_to_request(lambda)), "");
+}
+
+/* --- failure logs --- */
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  std::string emitted;
+
+  struct debug_record // holds the arguments, formatted only when emitted
+  {
+    void operator()() const noexcept
+    {
+      try { emitted += std::to_string(step) + ";"; } catch(...) {}
+    }
+
+    int step;
+  };
+
+  struct counted_record
+  {
+    explicit counted_record(int& live) noexcept : m_live(live) { ++m_live; }
+    counted_record(const counted_record& other) noexcept
+      : m_live(other.m_live) { ++m_live; }
+    ~counted_record() { --m_live; }
+    void operator()() const noexcept {}
+
+    int& m_live;
+  };
+
+  void handle_request(bool fail)
+  {
+    failure_log<debug_record, 8> log;
+    for(auto step = 1; step <= 3; ++step)
+      log.record(debug_record{step});
+
+    if(fail)
+      throw std::runtime_error{"request failed"};
+
+    log.dismiss(); // success: nothing is formatted or written
+  }
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A failure log emits its records oldest first when leaving scope "
+          "due to an exception, and drops them on success.")
+{
+  emitted.clear();
+  handle_request(false);
+  REQUIRE(emitted.empty());
+
+  REQUIRE_THROWS_AS(handle_request(true), std::runtime_error);
+  REQUIRE(emitted == "1;2;3;");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A full failure log overwrites its oldest records, keeping the "
+          "newest ones.")
+{
+  emitted.clear();
+  {
+    failure_log<debug_record, 3> log;
+    for(auto step = 1; step <= 5; ++step)
+      log.record(debug_record{step});
+
+    REQUIRE(log.size() == 3u);
+    REQUIRE(log.overwritten() == 2u);
+  }
+
+  REQUIRE(emitted == "3;4;5;");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A dismissed failure log emits nothing, destroys its records and can "
+          "record again.")
+{
+  emitted.clear();
+  auto live = 0;
+  {
+    failure_log<counted_record, 2> log;
+    for(auto i = 0; i < 3; ++i)
+      log.record(counted_record{live});
+
+    REQUIRE(live == 2);
+    log.dismiss();
+    REQUIRE_FALSE(live);
+    REQUIRE_FALSE(log.size());
+    REQUIRE_FALSE(log.overwritten());
+
+    log.record(counted_record{live});
+    REQUIRE(live == 1);
+  }
+
+  REQUIRE_FALSE(live);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A failure log that was dismissed and then records again emits only "
+          "the new records.")
+{
+  emitted.clear();
+  {
+    failure_log<debug_record, 4> log;
+    log.record(debug_record{1});
+    log.dismiss();
+    log.record(debug_record{2});
+  }
+
+  REQUIRE(emitted == "2;");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("Recording into a failure log is noexcept when constructing the "
+          "record is.")
+{
+  struct throwing_record
+  {
+    throwing_record() = default;
+    throwing_record(const throwing_record&) noexcept(false) {}
+    void operator()() const noexcept {}
+  };
+
+  failure_log<debug_record, 1> log;
+  failure_log<throwing_record, 1> throwing_log;
+  const auto record = throwing_record{};
+  static_assert(noexcept(log.record(debug_record{1})), "");
+  static_assert(!noexcept(throwing_log.record(record)), "");
+}
+
+/* --- miscellaneous --- */
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("Multiple independent scope_guards do not interfere with each "
+          "other - each of their post-conditions hold.")
+{
+  auto a = 0u;
+  auto b = 0u;
+  auto c = 0u;
+
+  {
+    auto guard_a = make_scope_guard([&a]() noexcept { incc(a); });
+    REQUIRE_FALSE(a);
+    REQUIRE_FALSE(b);
+    REQUIRE_FALSE(c);
+  }
+  REQUIRE(a == 1u);
+  REQUIRE_FALSE(b);
+  REQUIRE_FALSE(c);
+
+  {
+    auto guard_b = make_scope_guard([&b]() noexcept { incc(b); });
+    auto guard_c = make_scope_guard([&c]() noexcept { incc(c); });
+    REQUIRE(a == 1u);
+    REQUIRE_FALSE(b);
+    REQUIRE_FALSE(c);
+  }
+  REQUIRE(a == 1u);
+  REQUIRE(b == 1u);
+  REQUIRE(c == 1u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("Test nested scopes")
+{
+  auto lvl0_count  = 0u;
+  auto lvl1_count  = 0u;
+  auto lvl2a_count = 0u;
+  auto lvl2b_count = 0u;
+  auto lvl3a_count = 0u;
+  auto lvl3b_count = 0u;
+  auto lvl3c_count = 0u;
+
+  const auto lvl0_guard =
+    make_scope_guard([&lvl0_count]() noexcept { incc(lvl0_count); });
+  REQUIRE_FALSE(lvl0_count);
+
+  {
+    const auto lvl1_guard =
+      make_scope_guard([&lvl1_count]() noexcept { incc(lvl1_count); });
+
+    {
+      const auto lvl2a_guard =
+        make_scope_guard([&lvl2a_count]() noexcept { incc(lvl2a_count); });
+      REQUIRE_FALSE(lvl2a_count);
+
+      {
+        const auto lvl3a_guard =
+          make_scope_guard([&lvl3a_count]() noexcept { incc(lvl3a_count); });
+        REQUIRE_FALSE(lvl3a_count);
+      }
+
+      REQUIRE(lvl3a_count == 1);
+      REQUIRE_FALSE(lvl2a_count);
+    }
+
+    REQUIRE(lvl2a_count == 1);
+    REQUIRE_FALSE(lvl1_count);
+    REQUIRE_FALSE(lvl0_count);
+
+    {
+      const auto lvl2b_guard =
+        make_scope_guard([&lvl2b_count]() noexcept { incc(lvl2b_count); });
+      REQUIRE_FALSE(lvl2b_count);
+
+      {
+        const auto lvl3b_guard =
+          make_scope_guard([&lvl3b_count]() noexcept { incc(lvl3b_count); });
+        REQUIRE_FALSE(lvl3b_count);
+
+        const auto lvl3c_guard =
+          make_scope_guard([&lvl3c_count]() noexcept { incc(lvl3c_count); });
+        REQUIRE_FALSE(lvl3c_count);
+      }
+
+      REQUIRE(lvl3b_count == 1);
+      REQUIRE(lvl3c_count == 1);
+      REQUIRE_FALSE(lvl2b_count);
+
+    }
+
+    REQUIRE(lvl2b_count == 1);
+    REQUIRE_FALSE(lvl1_count);
+    REQUIRE_FALSE(lvl0_count);
+
+  }
+
+  REQUIRE(lvl1_count  == 1);
+  REQUIRE(lvl2a_count == 1);
+  REQUIRE(lvl2b_count == 1);
+  REQUIRE(lvl3a_count == 1);
+  REQUIRE(lvl3b_count == 1);
+  REQUIRE(lvl3c_count == 1);
+  REQUIRE_FALSE(lvl0_count);
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("Dismissing a scope_guard multiple times is the same as dismissing it"
+          "only once")
+{
+  reset();
+
+  for(auto i = 0; i < 100; ++i)
+  {
+    {
+      auto guard = make_scope_guard(inc);
+      for(int c = 0; c <= i; ++c)
+        guard.dismiss();
+      REQUIRE_FALSE(count);
+    }
+
+    REQUIRE_FALSE(count);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("scope_guards execute their callback exactly once when leaving "
+          "scope due to an exception")
+{
+  reset();
+  auto countl = 0u;
+
+  try
+  {
+    const auto guard = make_scope_guard(inc);
+    const auto guardl = make_scope_guard([&countl]() noexcept { ++countl; });
+    throw "foo";
+  }
+  catch(...)
+  {
+    REQUIRE(count == 1u);
+    REQUIRE(countl == 1u);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("dismissed scope_guards do not execute their callback when leaving "
+          "scope due to an exception")
+{
+  reset();
+  auto countl = 0u;
+
+  try
+  {
+    auto guard = make_scope_guard(inc);
+    auto guardl = make_scope_guard([&countl]() noexcept { ++countl; });
+
+    guard.dismiss();
+    guardl.dismiss();
+
+    throw "foo";
+  }
+  catch(...)
+  {
+    REQUIRE_FALSE(count);
+    REQUIRE_FALSE(countl);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  unsigned returning(unsigned ret)
+  {
+    if(ret)
+    {
+      const auto guard = make_scope_guard(inc);
+      return ret;
     }
 
     return 0u;
@@ -2166,6 +3656,60 @@ TEST_CASE("Callbacks that are used to make scope_guards can be called "
   REQUIRE(count == 5u);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  template<typename Callback>
+  struct callback_and_flag
+  {
+    Callback m_callback;
+    bool m_flag;
+  };
+
+  template<typename Callback>
+  bool is_callback_and_flag_sized(detail::scope_guard<Callback>&&)
+  {
+    return sizeof(detail::scope_guard<Callback>) <=
+      sizeof(callback_and_flag<Callback>);
+  }
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A scope_guard takes no more space than its callback plus an "
+          "activity flag, for every category of callback.")
+{
+  auto lambda_count = 0u;
+  auto& inc_ref = inc;
+  const auto lambda = [&lambda_count]() noexcept { incc(lambda_count); };
+  const auto functor = StatefulFunctor{lambda_count};
+
+  REQUIRE(is_callback_and_flag_sized(make_scope_guard(inc)));
+  REQUIRE(is_callback_and_flag_sized(make_scope_guard(inc_ref)));
+  REQUIRE(is_callback_and_flag_sized(make_scope_guard(&inc)));
+  REQUIRE(is_callback_and_flag_sized(make_scope_guard(lambda)));
+  REQUIRE(is_callback_and_flag_sized(make_scope_guard([]() noexcept {})));
+  REQUIRE(is_callback_and_flag_sized(
+    make_scope_guard([&lambda_count]() noexcept { incc(lambda_count); })));
+  REQUIRE(is_callback_and_flag_sized(make_scope_guard(StatelessFunctor{})));
+  REQUIRE(is_callback_and_flag_sized(make_scope_guard(functor)));
+  REQUIRE(is_callback_and_flag_sized(
+    make_scope_guard(StatefulFunctor{lambda_count})));
+}
+
+#ifndef SG_REQUIRE_NOEXCEPT
+////////////////////////////////////////////////////////////////////////////////
+TEST_CASE("A scope_guard takes no more space than its callback plus an "
+          "activity flag, also for callbacks that drop noexcept.")
+{
+  const auto stdf = std::function<void()>{inc};
+
+  REQUIRE(is_callback_and_flag_sized(make_scope_guard(stdf)));
+  REQUIRE(is_callback_and_flag_sized(
+    make_scope_guard(std::function<void()>{inc})));
+  REQUIRE(is_callback_and_flag_sized(make_scope_guard(std::bind(inc))));
+}
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 namespace
 {
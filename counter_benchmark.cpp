@@ -0,0 +1,120 @@
+/*
+ * Counter batching benchmark, only built with ENABLE_BENCHMARKS (see
+ * docs/tests.md).
+ *
+ * A number of threads process "requests", each incrementing a few shared
+ * atomic counters many times. This runs twice: first with a fetch_add per
+ * increment, then accumulating the increments in local variables that batch
+ * guards publish with a single fetch_add per counter at the end of each
+ * request. The wall time of both is reported, for different numbers of
+ * threads, and the program fails if the counters end up with different values.
+ */
+
+#include "scope_guard.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace sg;
+
+/* --- first some helpers --- */
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  using bench_clock = std::chrono::steady_clock;
+
+  constexpr auto requests_per_thread = 20000;
+  constexpr auto increments_per_request = 64;
+
+  struct counters
+  {
+    std::atomic<unsigned long> hits{0};
+    std::atomic<unsigned long> bytes{0};
+  };
+
+  void direct_request(counters& shared) noexcept
+  {
+    for(auto i = 0; i < increments_per_request; ++i)
+    {
+      shared.hits.fetch_add(1u);
+      shared.bytes.fetch_add(static_cast<unsigned long>(i));
+    }
+  }
+
+  void batched_request(counters& shared) noexcept
+  {
+    auto hits = 0ul;
+    auto bytes = 0ul;
+    const auto hits_guard = make_batch_guard(shared.hits, hits);
+    const auto bytes_guard = make_batch_guard(shared.bytes, bytes);
+
+    for(auto i = 0; i < increments_per_request; ++i)
+    {
+      ++hits;
+      bytes += static_cast<unsigned long>(i);
+    }
+  }
+
+  struct result
+  {
+    bench_clock::duration wall;
+    unsigned long hits;
+    unsigned long bytes;
+  };
+
+  result run(unsigned threads, void (*request)(counters&) noexcept)
+  {
+    counters shared;
+    const auto start = bench_clock::now();
+
+    std::vector<std::thread> workers;
+    for(auto t = 0u; t < threads; ++t)
+      workers.emplace_back([&shared, request]
+      {
+        for(auto r = 0; r < requests_per_thread; ++r)
+          request(shared);
+      });
+
+    for(auto& w : workers)
+      w.join();
+
+    const auto wall = bench_clock::now() - start;
+    return {wall, shared.hits.load(), shared.bytes.load()};
+  }
+
+  double ms(bench_clock::duration d)
+  {
+    return std::chrono::duration<double, std::milli>(d).count();
+  }
+} // namespace
+
+int main()
+{
+  auto ok = true;
+  std::cout << std::left << std::setw(10) << "threads"
+            << std::right << std::setw(16) << "fetch_add (ms)"
+            << std::setw(16) << "batched (ms)" << "\n"
+            << std::fixed << std::setprecision(1);
+
+  const auto hw = std::thread::hardware_concurrency();
+  for(auto threads = 1u; threads <= 2 * (hw ? hw : 1u); threads *= 2)
+  {
+    const auto direct = run(threads, direct_request);
+    const auto batched = run(threads, batched_request);
+    const auto agree = direct.hits == batched.hits &&
+                       direct.bytes == batched.bytes;
+    ok = ok && agree;
+
+    std::cout << std::left << std::setw(10) << threads
+              << std::right << std::setw(16) << ms(direct.wall)
+              << std::setw(16) << ms(batched.wall)
+              << (agree ? "" : "  <-- counters differ") << "\n";
+  }
+
+  return ok ? 0 : 1;
+}
@@ -8,8 +8,10 @@
 #ifndef SCOPE_GUARD_HPP_
 #define SCOPE_GUARD_HPP_
 
+#ifndef SG_AVOID_STD_HEADERS
 #include <type_traits>
 #include <utility>
+#endif
 
 #if __cplusplus >= 201703L
 #define SG_NODISCARD [[nodiscard]]
@@ -24,23 +26,242 @@ namespace sg
 {
   namespace detail
   {
+    /* --- The few standard library facilities we need --- */
+
+    typedef decltype(sizeof(0)) size_t; // without <cstddef>
+
+#ifndef SG_AVOID_STD_HEADERS
+    using std::true_type;
+    using std::false_type;
+    using std::is_same;
+    using std::conditional;
+    using std::enable_if;
+    using std::decay;
+    using std::declval;
+    using std::forward;
+    using std::is_nothrow_constructible;
+    using std::is_nothrow_destructible;
+    using std::is_trivially_destructible;
+#ifdef SG_REQUIRE_NOEXCEPT
+    using std::is_nothrow_invocable;
+#endif
+#else
+    /* Minimal replacements, so that neither <type_traits> nor <utility> need
+    to be preprocessed and parsed. Only what this header needs is provided. */
+    template<bool B>
+    struct bool_constant
+    {
+      static constexpr bool value = B;
+    };
+
+    using true_type = bool_constant<true>;
+    using false_type = bool_constant<false>;
+
+    template<typename A, typename B>
+    struct is_same : false_type
+    {};
+
+    template<typename A>
+    struct is_same<A, A> : true_type
+    {};
+
+    template<bool B, typename T, typename F>
+    struct conditional
+    {
+      typedef T type;
+    };
+
+    template<typename T, typename F>
+    struct conditional<false, T, F>
+    {
+      typedef F type;
+    };
+
+    template<bool B, typename T = void>
+    struct enable_if
+    {};
+
+    template<typename T>
+    struct enable_if<true, T>
+    {
+      typedef T type;
+    };
+
+    template<typename T>
+    struct remove_reference
+    {
+      typedef T type;
+    };
+
+    template<typename T>
+    struct remove_reference<T&>
+    {
+      typedef T type;
+    };
+
+    template<typename T>
+    struct remove_reference<T&&>
+    {
+      typedef T type;
+    };
+
+    template<typename T>
+    struct remove_cv
+    {
+      typedef T type;
+    };
+
+    template<typename T>
+    struct remove_cv<const T>
+    {
+      typedef T type;
+    };
+
+    template<typename T>
+    struct remove_cv<volatile T>
+    {
+      typedef T type;
+    };
+
+    template<typename T>
+    struct remove_cv<const volatile T>
+    {
+      typedef T type;
+    };
+
+    template<typename T,
+             bool = is_same<const typename remove_cv<T>::type,
+                            typename remove_cv<T>::type>::value>
+    struct decay_non_reference
+    {
+      typedef typename remove_cv<T>::type type;
+    }; // objects (const T is distinct from T, once cv-qualifiers are removed)
+
+    template<typename T>
+    struct decay_non_reference<T, true>
+    {
+      typedef T* type;
+    }; // functions (const is ignored for function types)
+
+    template<typename T, size_t N>
+    struct decay_non_reference<T[N], false>
+    {
+      typedef T* type;
+    };
+
+    template<typename T>
+    struct decay_non_reference<T[], false>
+    {
+      typedef T* type;
+    };
+
+    template<typename T>
+    struct decay
+      : public decay_non_reference<typename remove_reference<T>::type>
+    {};
+
+    template<typename T>
+    T&& declval() noexcept; // only for unevaluated contexts
+
+    template<typename T>
+    constexpr T&& forward(typename remove_reference<T>::type& t) noexcept
+    {
+      return static_cast<T&&>(t);
+    }
+
+    template<typename T>
+    constexpr T&& forward(typename remove_reference<T>::type&& t) noexcept
+    {
+      return static_cast<T&&>(t);
+    }
+
+#if defined(__has_builtin)
+#if __has_builtin(__is_nothrow_constructible)
+#define SG_HAS_NOTHROW_CONSTRUCTIBLE_BUILTIN
+#endif
+#elif defined(_MSC_VER)
+#define SG_HAS_NOTHROW_CONSTRUCTIBLE_BUILTIN
+#endif
+
+#ifdef SG_HAS_NOTHROW_CONSTRUCTIBLE_BUILTIN
+#undef SG_HAS_NOTHROW_CONSTRUCTIBLE_BUILTIN
+    template<typename T, typename Arg>
+    struct is_nothrow_constructible
+      : bool_constant<__is_nothrow_constructible(T, Arg)>
+    {};
+#else
+    template<typename T, typename Arg, typename = void>
+    struct is_nothrow_constructible : false_type
+    {}; // in general, false
+
+    template<typename T, typename Arg>
+    struct is_nothrow_constructible<T, Arg, decltype(void(T(declval<Arg>())))>
+      : bool_constant<noexcept(T(declval<Arg>()))>
+    {}; /* only when construction valid (note: T(arg) involves destroying a
+           temporary, but callback types with throwing dtors are rejected
+           anyway) */
+#endif
+
+    template<typename T, typename = void>
+    struct is_nothrow_object_destructible : false_type
+    {}; // in general, false
+
+    template<typename T>
+    struct is_nothrow_object_destructible<T, decltype(declval<T&>().~T())>
+      : bool_constant<noexcept(declval<T&>().~T())>
+    {}; // true when destructor valid and noexcept
+
+    template<typename T>
+    struct is_nothrow_destructible : is_nothrow_object_destructible<T>
+    {}; // references are kept away from the destructor call expression...
+
+    template<typename T>
+    struct is_nothrow_destructible<T&> : true_type
+    {}; // ... since they have nothing to destroy
+
+    template<typename T>
+    struct is_nothrow_destructible<T&&> : true_type
+    {}; // idem
+
+    template<typename T>
+    struct is_trivially_destructible
+#if defined(__clang__) || defined(_MSC_VER)
+      : bool_constant<__is_trivially_destructible(T)>
+#else
+      : bool_constant<__has_trivial_destructor(T)>
+#endif
+    {}; // only needed for class types (e.g. closures) and pointers
+
+#ifdef SG_REQUIRE_NOEXCEPT
+    template<typename T, typename = void>
+    struct is_nothrow_invocable : false_type
+    {}; // in general, false
+
+    template<typename T>
+    struct is_nothrow_invocable<T, decltype(void(declval<T&&>()()))>
+      : bool_constant<noexcept(declval<T&&>()())>
+    {}; // only when call expression valid (with no arguments only)
+#endif
+#endif
+
+
     /* --- Some custom type traits --- */
 
     // Type trait determining whether a type is callable with no arguments
     template<typename T, typename = void>
     struct is_noarg_callable_t
-      : public std::false_type
+      : public false_type
     {}; // in general, false
 
     template<typename T>
-    struct is_noarg_callable_t<T, decltype(std::declval<T&&>()())>
-      : public std::true_type
+    struct is_noarg_callable_t<T, decltype(declval<T&&>()())>
+      : public true_type
     {}; // only true when call expression valid
 
     // Type trait determining whether a no-argument callable returns void
     template<typename T>
     struct returns_void_t
-      : public std::is_same<void, decltype(std::declval<T&&>()())>
+      : public is_same<void, decltype(declval<T&&>()())>
     {};
 
     /* Type trait determining whether a no-arg callable is nothrow invocable if
@@ -49,12 +270,12 @@ namespace sg
     struct is_nothrow_invocable_if_required_t
       : public
 #ifdef SG_REQUIRE_NOEXCEPT
-          std::is_nothrow_invocable<T> /* Note: _r variants not enough to
-                                          confirm void return: any return can be
-                                          discarded so all returns are
-                                          compatible with void */
+          is_nothrow_invocable<T> /* Note: _r variants not enough to
+                                     confirm void return: any return can be
+                                     discarded so all returns are compatible
+                                     with void */
 #else
-          std::true_type
+          true_type
 #endif
     {};
 
@@ -64,7 +285,7 @@ namespace sg
     {}; // for more than two arguments
 
     template<typename A, typename B>
-    struct and_t<A, B> : public std::conditional<A::value, B, A>::type
+    struct and_t<A, B> : public conditional<A::value, B, A>::type
     {}; // for two arguments
 
     // Type trait determining whether a type is a proper scope_guard callback.
@@ -73,14 +294,14 @@ namespace sg
       : public and_t<is_noarg_callable_t<T>,
                      returns_void_t<T>,
                      is_nothrow_invocable_if_required_t<T>,
-                     std::is_nothrow_destructible<T>>
+                     is_nothrow_destructible<T>>
     {};
 
 
     /* --- The actual scope_guard template --- */
 
     template<typename Callback,
-             typename = typename std::enable_if<
+             typename = typename enable_if<
                is_proper_sg_callback_t<Callback>::value>::type>
     class scope_guard;
 
@@ -89,7 +310,7 @@ namespace sg
 
     template<typename Callback>
     detail::scope_guard<Callback> make_scope_guard(Callback&& callback)
-    noexcept(std::is_nothrow_constructible<Callback, Callback&&>::value); /*
+    noexcept(is_nothrow_constructible<Callback, Callback&&>::value); /*
     we need this in the inner namespace due to MSVC bugs preventing
     sg::detail::scope_guard from befriending a sg::make_scope_guard
     template instance in the parent namespace (see https://is.gd/xFfFhE). */
@@ -104,7 +325,7 @@ namespace sg
       typedef Callback callback_type;
 
       scope_guard(scope_guard&& other)
-      noexcept(std::is_nothrow_constructible<Callback, Callback&&>::value);
+      noexcept(is_nothrow_constructible<Callback, Callback&&>::value);
 
       ~scope_guard() noexcept; // highlight noexcept dtor
 
@@ -118,11 +339,11 @@ namespace sg
 
     private:
       explicit scope_guard(Callback&& callback)
-      noexcept(std::is_nothrow_constructible<Callback, Callback&&>::value); /*
+      noexcept(is_nothrow_constructible<Callback, Callback&&>::value); /*
                                                       meant for friends only */
 
       friend scope_guard<Callback> make_scope_guard<Callback>(Callback&&)
-      noexcept(std::is_nothrow_constructible<Callback, Callback&&>::value); /*
+      noexcept(is_nothrow_constructible<Callback, Callback&&>::value); /*
       only make_scope_guard can create scope_guards from scratch (i.e. non-move)
       */
 
@@ -132,59 +353,1344 @@ namespace sg
 
     };
 
-  } // namespace detail
 
+    /* --- Support for callbacks that return errors --- */
 
-  /* --- Now the single public maker function --- */
+    /* Type trait determining whether the result of calling a type with no
+    arguments can be recorded by an aggregator */
+    template<typename T, typename Aggregator, typename = void>
+    struct is_recordable_callback_t
+      : public false_type
+    {}; // in general, false
 
-  using detail::make_scope_guard; // see comment on declaration above
+    template<typename T, typename Aggregator>
+    struct is_recordable_callback_t<
+      T, Aggregator,
+      decltype(declval<Aggregator&>().record(declval<T&&>()()))>
+      : public true_type
+    {}; // only true when recording the call result is valid
 
-} // namespace sg
+    /* Type trait determining whether the result of calling a type with no
+    arguments can be recorded by an aggregator without throwing */
+    template<typename T, typename Aggregator, typename = void>
+    struct is_nothrow_recordable_callback_t
+      : public false_type
+    {}; // in general, false
 
-////////////////////////////////////////////////////////////////////////////////
-template<typename Callback>
-sg::detail::scope_guard<Callback>::scope_guard(Callback&& callback)
-noexcept(std::is_nothrow_constructible<Callback, Callback&&>::value)
-  : m_callback(std::forward<Callback>(callback)) /* use () instead of {} because
-    of DR 1467 (https://is.gd/WHmWuo), which still impacts older compilers
-    (e.g. GCC 4.x and clang <=3.6, see https://godbolt.org/g/TE9tPJ and
-    https://is.gd/Tsmh8G) */
-  , m_active{true}
-{}
+    template<typename T, typename Aggregator>
+    struct is_nothrow_recordable_callback_t<
+      T, Aggregator,
+      typename enable_if<
+        is_recordable_callback_t<T, Aggregator>::value>::type>
+      : public conditional<
+          noexcept(declval<Aggregator&>().record(declval<T&>()())),
+          true_type, false_type>::type
+    {}; /* only true when recording the call result is valid and noexcept
+           (note: callbacks are called as lvalues by the adapter below) */
 
-////////////////////////////////////////////////////////////////////////////////
-template<typename Callback>
-sg::detail::scope_guard<Callback>::scope_guard::~scope_guard() noexcept  /*
-need the extra injected-class-name here to make different compilers happy */
-{
-  if(m_active)
-    m_callback();
-}
+    /* Adapter that turns a fallible callback into a void one, by recording its
+    result in an aggregator */
+    template<typename Callback, typename Aggregator>
+    class recording_callback final
+    {
+    public:
+      recording_callback(Callback&& callback, Aggregator& aggregator)
+      noexcept(is_nothrow_constructible<Callback, Callback&&>::value);
 
-////////////////////////////////////////////////////////////////////////////////
-template<typename Callback>
-sg::detail::scope_guard<Callback>::scope_guard(scope_guard&& other)
-noexcept(std::is_nothrow_constructible<Callback, Callback&&>::value)
-  : m_callback(std::forward<Callback>(other.m_callback)) // idem
-  , m_active{std::move(other.m_active)}
-{
-  other.m_active = false;
-}
+      void operator()()
+      noexcept(is_nothrow_recordable_callback_t<Callback, Aggregator>::value);
 
-////////////////////////////////////////////////////////////////////////////////
-template<typename Callback>
-inline void sg::detail::scope_guard<Callback>::dismiss() noexcept
-{
-  m_active = false;
-}
+    private:
+      Callback m_callback;
+      Aggregator& m_aggregator;
+    };
 
-////////////////////////////////////////////////////////////////////////////////
-template<typename Callback>
-inline auto sg::detail::make_scope_guard(Callback&& callback)
-noexcept(std::is_nothrow_constructible<Callback, Callback&&>::value)
--> detail::scope_guard<Callback>
-{
-  return detail::scope_guard<Callback>{std::forward<Callback>(callback)};
+
+    /* --- Support for callbacks with bound arguments --- */
+
+    // logic AND of zero or more booleans
+    template<bool... B>
+    struct all_t : public true_type
+    {}; // for no arguments
+
+    template<bool... B>
+    struct all_t<false, B...> : public false_type
+    {};
+
+    template<bool... B>
+    struct all_t<true, B...> : public all_t<B...>
+    {};
+
+    // compile-time sequence of indices, to unpack stored arguments
+    template<size_t... I>
+    struct index_sequence
+    {};
+
+    template<size_t N, size_t... I>
+    struct make_index_sequence_t
+      : public make_index_sequence_t<N - 1, N - 1, I...>
+    {};
+
+    template<size_t... I>
+    struct make_index_sequence_t<0, I...>
+    {
+      typedef index_sequence<I...> type;
+    };
+
+    /* An element of a compressed tuple. Empty non-final classes are inherited
+    from instead of held, so that they take no space (empty base optimization).
+    The index distinguishes elements of the same type. */
+    template<size_t I, typename T, bool = __is_empty(T) && !__is_final(T)>
+    class compressed_leaf
+    {
+    public:
+      template<typename U>
+      explicit compressed_leaf(U&& value)
+      noexcept(is_nothrow_constructible<T, U&&>::value)
+        : m_value(detail::forward<U>(value)) // () for DR 1467, see below
+      {}
+
+      T& get() noexcept { return m_value; }
+
+    private:
+      T m_value;
+    };
+
+    template<size_t I, typename T>
+    class compressed_leaf<I, T, true> : private T
+    {
+    public:
+      template<typename U>
+      explicit compressed_leaf(U&& value)
+      noexcept(is_nothrow_constructible<T, U&&>::value)
+        : T(detail::forward<U>(value))
+      {}
+
+      T& get() noexcept { return *this; }
+    };
+
+    /* Type trait determining whether a type is callable with lvalues of the
+    specified argument types, returning void */
+    template<typename T, typename Args, typename = void>
+    struct is_void_bound_callable_t
+      : public false_type
+    {}; // in general, false
+
+    template<typename T, typename... Args>
+    struct is_void_bound_callable_t<
+      T, void(Args...),
+      typename enable_if<is_same<
+        void, decltype(declval<T&>()(declval<Args&>()...))>::value>::type>
+      : public true_type
+    {}; // only true when call expression valid and void
+
+    /* Type trait determining whether a type is nothrow callable with lvalues
+    of the specified argument types, returning void */
+    template<typename T, typename Args, typename = void>
+    struct is_nothrow_void_bound_callable_t
+      : public false_type
+    {}; // in general, false
+
+    template<typename T, typename... Args>
+    struct is_nothrow_void_bound_callable_t<
+      T, void(Args...),
+      typename enable_if<is_void_bound_callable_t<
+        T, void(Args...)>::value>::type>
+      : public conditional<noexcept(declval<T&>()(declval<Args&>()...)),
+                           true_type, false_type>::type
+    {}; // only true when call expression valid, void, and noexcept
+
+    /* Adapter that holds a callback and its arguments in a compressed tuple,
+    and invokes the former with the latter when called with no arguments */
+    template<typename Indices, typename Callback, typename... Args>
+    class bound_callback;
+
+    template<size_t... I, typename Callback, typename... Args>
+    class bound_callback<index_sequence<I...>, Callback, Args...> final
+      : private compressed_leaf<0, Callback>
+      , private compressed_leaf<I + 1, Args>...
+    {
+    public:
+      template<typename C, typename... A>
+      explicit bound_callback(C&& callback, A&&... args)
+      noexcept(all_t<is_nothrow_constructible<Callback, C&&>::value,
+                     is_nothrow_constructible<Args, A&&>::value...>::value);
+
+      void operator()()
+      noexcept(is_nothrow_void_bound_callable_t<Callback,
+                                                void(Args...)>::value);
+    };
+
+    // The bound_callback type for a callback and the arguments to bind to it
+    template<typename Callback, typename... Args>
+    using bound_callback_t = bound_callback<
+      typename make_index_sequence_t<sizeof...(Args)>::type,
+      Callback, typename decay<Args>::type...>;
+
+    /* Type trait determining whether binding arguments to a callback can be
+    done without throwing (i.e. constructing and moving the bound_callback) */
+    template<typename Callback, typename... Args>
+    struct is_nothrow_bindable_t
+      : public conditional<
+          noexcept(bound_callback_t<Callback, Args...>{
+                     declval<Callback>(), declval<Args>()...}) &&
+          is_nothrow_constructible<
+            bound_callback_t<Callback, Args...>,
+            bound_callback_t<Callback, Args...>&&>::value,
+          true_type, false_type>::type
+    {};
+
+
+    /* --- Support for restoring variables --- */
+
+    /* Type trait determining whether an expression of type U can be assigned
+    to an expression of type T */
+    template<typename T, typename U, typename = void>
+    struct is_assignable_t
+      : public false_type
+    {}; // in general, false
+
+    template<typename T, typename U>
+    struct is_assignable_t<T, U, decltype(void(declval<T>() = declval<U>()))>
+      : public true_type
+    {}; // only true when assignment expression valid
+
+    /* Type trait determining whether an expression of type U can be assigned
+    to an expression of type T without throwing */
+    template<typename T, typename U, typename = void>
+    struct is_nothrow_assignable_t
+      : public false_type
+    {}; // in general, false
+
+    template<typename T, typename U>
+    struct is_nothrow_assignable_t<
+      T, U, typename enable_if<is_assignable_t<T, U>::value>::type>
+      : public conditional<noexcept(declval<T>() = declval<U>()),
+                           true_type, false_type>::type
+    {}; // only true when assignment expression valid and noexcept
+
+    /* Type trait determining whether the value of a variable of type T can be
+    saved (copied) and later restored (moved back) */
+    template<typename T, typename = void>
+    struct is_restorable_t
+      : public false_type
+    {}; // in general, false (e.g. const variables)
+
+    template<typename T>
+    struct is_restorable_t<T, decltype(void(T(declval<T&>())))>
+      : public is_assignable_t<T&, T&&>
+    {}; // only when copy construction valid, then if move assignment valid
+
+    /* Type trait determining whether the value of a variable of type T can be
+    saved without throwing (i.e. copying it and moving the copy into a guard) */
+    template<typename T>
+    struct is_nothrow_saveable_t
+      : public conditional<is_nothrow_constructible<T, T&>::value &&
+                           is_nothrow_constructible<T, T&&>::value,
+                           true_type, false_type>::type
+    {};
+
+    // Type trait determining whether a type is a floating point type
+    template<typename T>
+    struct is_floating_t
+      : public false_type
+    {}; // in general, false
+
+    template<> struct is_floating_t<float> : public true_type {};
+    template<> struct is_floating_t<double> : public true_type {};
+    template<> struct is_floating_t<long double> : public true_type {};
+
+    /* Type trait determining whether restoring a variable of type T can be
+    skipped when it compares equal to the saved value, i.e. whether T is a
+    non-volatile scalar that fits in a register and whose equality means
+    identity (unlike floating point, where 0.0 == -0.0) */
+    template<typename T, typename = void>
+    struct is_skippable_restore_t
+      : public false_type
+    {}; // in general, false
+
+    template<typename T>
+    struct is_skippable_restore_t<
+      T, decltype(void(declval<T&>() == declval<T&>()))>
+      : public conditional<!__is_class(T) && !__is_union(T) &&
+                           sizeof(T) <= sizeof(void*) &&
+                           !is_same<volatile T, T>::value &&
+                           !is_floating_t<T>::value,
+                           true_type, false_type>::type
+    {}; // only true for integers, enumerations and pointers
+
+    /* Callback that restores a variable to the value it had when the callback
+    was created. Only the reference and the saved value are held. */
+    template<typename T>
+    class restore_callback final
+    {
+    public:
+      explicit restore_callback(T& variable)
+      noexcept(is_nothrow_constructible<T, T&>::value);
+
+      void operator()()
+      noexcept(is_nothrow_assignable_t<T&, T&&>::value);
+
+    private:
+      void restore(true_type) noexcept; // skippable
+      void restore(false_type)
+      noexcept(is_nothrow_assignable_t<T&, T&&>::value); // otherwise
+
+    private:
+      T& m_variable;
+      T m_saved;
+    };
+
+
+    /* --- And the maker for callbacks with arguments --- */
+
+    template<typename Callback, typename Arg, typename... Args>
+    auto make_scope_guard(Callback&& callback, Arg&& arg, Args&&... args)
+    noexcept(is_nothrow_bindable_t<Callback, Arg, Args...>::value)
+    -> typename enable_if<
+         is_void_bound_callable_t<
+           Callback, void(typename decay<Arg>::type,
+                          typename decay<Args>::type...)>::value,
+         scope_guard<bound_callback_t<Callback, Arg, Args...>>>::type; /*
+    idem (an overload of the one above, made available in the parent namespace
+    by the same using-declaration) */
+
+    /* --- Support for unlocking around slow work --- */
+
+    // Type trait determining whether a type can be locked and unlocked
+    template<typename T, typename = void>
+    struct is_basic_lockable_t
+      : public false_type
+    {}; // in general, false
+
+    template<typename T>
+    struct is_basic_lockable_t<T, decltype(void(declval<T&>().lock()),
+                                           void(declval<T&>().unlock()))>
+      : public true_type
+    {}; // only true when both lock and unlock expressions valid
+
+    // Type trait determining whether a lockable type can be unlocked nothrow
+    template<typename T, typename = void>
+    struct is_nothrow_unlockable_t
+      : public false_type
+    {}; // in general, false
+
+    template<typename T>
+    struct is_nothrow_unlockable_t<
+      T, typename enable_if<is_basic_lockable_t<T>::value>::type>
+      : public conditional<noexcept(declval<T&>().unlock()),
+                           true_type, false_type>::type
+    {}; // only true when lockable and unlock is noexcept
+
+    /* Callback that locks a lockable again. Failing to do so would leave the
+    caller without the lock it expects to hold, so it is noexcept regardless:
+    if lock throws, std::terminate is called. */
+    template<typename Lockable>
+    class relock_callback final
+    {
+    public:
+      explicit relock_callback(Lockable& lockable) noexcept;
+
+      void operator()() noexcept;
+
+    private:
+      Lockable& m_lockable;
+    };
+
+
+    /* --- Support for batching counter updates --- */
+
+    /* Type trait determining whether a delta of type D can be published into
+    a counter of type C, with a single fetch_add */
+    template<typename C, typename D, typename = void>
+    struct is_batchable_t
+      : public false_type
+    {}; // in general, false
+
+    template<typename C, typename D>
+    struct is_batchable_t<C, D, decltype(void(declval<C&>().fetch_add(
+                                                declval<D&>())),
+                                         void(declval<D&>() != D{}))>
+      : public true_type
+    {}; // only true when fetch_add valid and deltas can be compared with zero
+
+    /* Type trait determining whether a delta of type D can be published into
+    a counter of type C without throwing */
+    template<typename C, typename D, typename = void>
+    struct is_nothrow_batchable_t
+      : public false_type
+    {}; // in general, false
+
+    template<typename C, typename D>
+    struct is_nothrow_batchable_t<
+      C, D, typename enable_if<is_batchable_t<C, D>::value>::type>
+      : public conditional<noexcept(declval<C&>().fetch_add(declval<D&>())) &&
+                           noexcept(declval<D&>() != D{}),
+                           true_type, false_type>::type
+    {}; // only true when batchable and both operations noexcept
+
+    /* Callback that publishes the delta accumulated in a (thread-local)
+    variable into a (shared) counter, skipping the update when there is none */
+    template<typename Counter, typename Delta>
+    class publish_callback final
+    {
+    public:
+      publish_callback(Counter& counter, Delta& delta) noexcept;
+
+      void operator()()
+      noexcept(is_nothrow_batchable_t<Counter, Delta>::value);
+
+    private:
+      Counter& m_counter;
+      Delta& m_delta;
+    };
+
+
+    /* --- Support for actions around outermost scopes only --- */
+
+    /* Callback that decrements a nesting depth and runs the wrapped callback
+    when it drops back to zero, i.e. when leaving the outermost scope. If it is
+    destroyed without being invoked (i.e. its guard was dismissed), it still
+    decrements the depth, but does not run the wrapped callback. */
+    template<typename Depth, typename Callback>
+    class outermost_callback final : private compressed_leaf<0, Callback>
+    {
+    public:
+      outermost_callback(Depth& depth, Callback&& callback)
+      noexcept(is_nothrow_constructible<Callback, Callback&&>::value);
+
+      outermost_callback(outermost_callback&& other)
+      noexcept(is_nothrow_constructible<Callback, Callback&&>::value);
+
+      ~outermost_callback() noexcept;
+
+      void operator()()
+      noexcept(is_nothrow_void_bound_callable_t<Callback, void()>::value);
+
+    public:
+      outermost_callback(const outermost_callback&) = delete;
+      outermost_callback& operator=(const outermost_callback&) = delete;
+      outermost_callback& operator=(outermost_callback&&) = delete;
+
+    private:
+      Depth* m_depth; // null once the depth is given back (or moved away)
+    };
+
+    /* Type trait determining whether an outermost guard can be made without
+    throwing (i.e. entering, storing the callback and moving it into a guard) */
+    template<typename Depth, typename Enter, typename Leave>
+    struct is_nothrow_outermost_t
+      : public conditional<
+          is_nothrow_void_bound_callable_t<Enter, void()>::value &&
+          is_nothrow_constructible<Leave, Leave&&>::value &&
+          is_nothrow_constructible<outermost_callback<Depth, Leave>,
+                                   outermost_callback<Depth, Leave>&&>::value,
+          true_type, false_type>::type
+    {};
+
+
+    /* --- Support for batch invalidation by generation --- */
+
+    /* Type trait determining whether a generation of type G can be bumped
+    (i.e. pre-incremented) and the bump undone (i.e. pre-decremented) */
+    template<typename G, typename = void>
+    struct is_bumpable_t
+      : public false_type
+    {}; // in general, false
+
+    template<typename G>
+    struct is_bumpable_t<G, decltype(void(++declval<G&>()),
+                                     void(--declval<G&>()))>
+      : public true_type
+    {}; // only true when pre-increment and pre-decrement valid
+
+    /* Type trait determining whether a generation of type G can be bumped
+    without throwing */
+    template<typename G, typename = void>
+    struct is_nothrow_bumpable_t
+      : public false_type
+    {}; // in general, false
+
+    template<typename G>
+    struct is_nothrow_bumpable_t<
+      G, typename enable_if<is_bumpable_t<G>::value>::type>
+      : public conditional<noexcept(++declval<G&>()) &&
+                           noexcept(--declval<G&>()),
+                           true_type, false_type>::type
+    {}; // only true when bumpable and both operations noexcept
+
+    /* Callback that bumps a generation that was already bumped when entering
+    the scope (marking it under update), so that it ends up past everything
+    stamped before. If it is destroyed without being invoked (i.e. its guard
+    was dismissed), it undoes the entry bump instead, restoring the generation
+    as it was. */
+    template<typename Generation>
+    class bump_callback final
+    {
+    public:
+      explicit bump_callback(Generation& generation) noexcept;
+      bump_callback(bump_callback&& other) noexcept;
+      ~bump_callback() noexcept;
+
+      void operator()() noexcept(is_nothrow_bumpable_t<Generation>::value);
+
+    public:
+      bump_callback(const bump_callback&) = delete;
+      bump_callback& operator=(const bump_callback&) = delete;
+      bump_callback& operator=(bump_callback&&) = delete;
+
+    private:
+      Generation* m_generation; // null once bumped or restored (or moved away)
+    };
+
+
+    /* --- Support for request-scoped cleanup contexts --- */
+
+    // A type with the strictest alignment that cleanup arenas provide
+    union max_align_t
+    {
+      long double m_long_double;
+      long long m_long_long;
+      void* m_pointer;
+      void (*m_function)();
+    };
+
+    // Tag to select sg's own placement new (which does not require <new>)
+    struct placement_tag
+    {};
+
+    // Header of a cleanup deferred into an arena, followed by the callback
+    struct deferred_cleanup
+    {
+      void (*m_run)(void* callback, bool invoke); // (runs and) destroys it
+      deferred_cleanup* m_previous; // the one deferred before (nullptr if none)
+    };
+
+    /* A LIFO stack of cleanups in a caller-provided arena. While it lives, it
+    is the ambient stack of the current thread (see current()), taking the place
+    of the previous one, which it puts back when destroyed. */
+    class cleanup_stack final
+    {
+    public:
+      cleanup_stack(unsigned char* arena, size_t capacity) noexcept;
+      ~cleanup_stack() noexcept; // runs the deferred cleanups, last first
+
+      void dismiss() noexcept; // drops the deferred cleanups without running
+
+      template<typename Callback>
+      bool push(Callback&& callback)
+      noexcept(is_nothrow_constructible<typename decay<Callback>::type,
+                                        Callback&&>::value);
+
+      static cleanup_stack*& current() noexcept; // nullptr if none
+
+    public:
+      cleanup_stack(const cleanup_stack&) = delete;
+      cleanup_stack& operator=(const cleanup_stack&) = delete;
+
+    private:
+      template<typename Callback>
+      static void run(void* callback, bool invoke) noexcept;
+
+      void unwind(bool invoke) noexcept;
+
+      static constexpr size_t aligned(size_t size) noexcept;
+
+    private:
+      unsigned char* m_arena;
+      size_t m_capacity;
+      size_t m_used;
+      deferred_cleanup* m_last;
+      size_t m_nontrivial; // number of cleanups with something to destroy
+      cleanup_stack* m_previous;
+    };
+
+  } // namespace detail
+
+
+  /* --- Now the public maker function (overloaded for bound arguments) --- */
+
+  using detail::make_scope_guard; // see comment on declarations above
+
+
+  /* --- A fixed-size aggregator of errors, for fallible callbacks --- */
+
+  template<typename Error, detail::size_t Capacity>
+  class error_aggregator final
+  {
+    static_assert(Capacity > 0, "error_aggregator needs room for one error");
+
+  public:
+    typedef Error error_type;
+
+    void record(const Error& error) noexcept;
+    void clear() noexcept;
+
+    detail::size_t size() const noexcept;
+    detail::size_t failures() const noexcept;
+
+    const Error& operator[](detail::size_t i) const noexcept;
+    const Error* begin() const noexcept;
+    const Error* end() const noexcept;
+
+  private:
+    Error m_errors[Capacity] = {};
+    detail::size_t m_size = 0;
+    detail::size_t m_failures = 0;
+  };
+
+
+  /* --- And the maker for fallible callbacks --- */
+
+  template<typename Callback, typename Aggregator>
+  auto make_fallible_scope_guard(Callback&& callback, Aggregator& errors)
+  noexcept(detail::is_nothrow_constructible<Callback, Callback&&>::value)
+  -> typename detail::enable_if<
+       detail::is_recordable_callback_t<Callback, Aggregator>::value,
+       detail::scope_guard<
+         detail::recording_callback<Callback, Aggregator>>>::type;
+
+
+  /* --- And the makers for guards that restore variables --- */
+
+  template<typename T>
+  auto make_restore_guard(T& variable)
+  noexcept(detail::is_nothrow_saveable_t<T>::value)
+  -> typename detail::enable_if<
+       detail::is_restorable_t<T>::value,
+       detail::scope_guard<detail::restore_callback<T>>>::type;
+
+  template<typename T, typename U>
+  auto make_override_guard(T& variable, U&& value)
+  noexcept(detail::is_nothrow_saveable_t<T>::value &&
+           detail::is_nothrow_assignable_t<T&, U&&>::value)
+  -> typename detail::enable_if<
+       detail::is_restorable_t<T>::value &&
+       detail::is_assignable_t<T&, U&&>::value,
+       detail::scope_guard<detail::restore_callback<T>>>::type;
+
+
+  /* --- And the maker for guards that unlock around slow work --- */
+
+  template<typename Lockable>
+  auto make_unlock_guard(Lockable& lockable)
+  noexcept(detail::is_nothrow_unlockable_t<Lockable>::value)
+  -> typename detail::enable_if<
+       detail::is_basic_lockable_t<Lockable>::value,
+       detail::scope_guard<detail::relock_callback<Lockable>>>::type;
+
+
+  /* --- And the maker for guards that batch counter updates --- */
+
+  template<typename Counter, typename Delta>
+  auto make_batch_guard(Counter& counter, Delta& delta) noexcept
+  -> typename detail::enable_if<
+       detail::is_batchable_t<Counter, Delta>::value,
+       detail::scope_guard<detail::publish_callback<Counter, Delta>>>::type;
+
+
+  /* --- And the maker for guards that act around outermost scopes only --- */
+
+  template<typename Depth, typename Enter, typename Leave>
+  auto make_outermost_guard(Depth& depth, Enter&& enter, Leave&& leave)
+  noexcept(detail::is_nothrow_outermost_t<Depth, Enter, Leave>::value)
+  -> typename detail::enable_if<
+       detail::is_void_bound_callable_t<Enter, void()>::value &&
+       detail::is_proper_sg_callback_t<Leave>::value,
+       detail::scope_guard<detail::outermost_callback<Depth, Leave>>>::type;
+
+
+  /* --- And the maker for guards that invalidate by generation --- */
+
+  template<typename Generation>
+  auto make_generation_guard(Generation& generation)
+  noexcept(detail::is_nothrow_bumpable_t<Generation>::value)
+  -> typename detail::enable_if<
+       detail::is_bumpable_t<Generation>::value,
+       detail::scope_guard<detail::bump_callback<Generation>>>::type;
+
+
+  /* --- Ambient cleanup contexts, for cleanups that outlive local scopes --- */
+
+  template<detail::size_t Bytes>
+  class cleanup_context final
+  {
+  public:
+    cleanup_context() noexcept;
+
+    void dismiss() noexcept;
+
+  public:
+    cleanup_context(const cleanup_context&) = delete;
+    cleanup_context& operator=(const cleanup_context&) = delete;
+
+  private:
+    alignas(detail::max_align_t) unsigned char m_arena[Bytes];
+    detail::cleanup_stack m_stack; // after the arena, so destroyed before it
+  };
+
+  template<typename Callback>
+  SG_NODISCARD auto defer_to_request(Callback&& callback)
+  noexcept(detail::is_nothrow_constructible<
+             typename detail::decay<Callback>::type, Callback&&>::value)
+  -> typename detail::enable_if<
+       detail::is_proper_sg_callback_t<
+         typename detail::decay<Callback>::type>::value,
+       bool>::type;
+
+
+  /* --- A bounded ring of records, only emitted on failure --- */
+
+  template<typename Record, detail::size_t Capacity>
+  class failure_log final
+  {
+    static_assert(Capacity > 0, "failure_log needs room for one record");
+    static_assert(detail::is_proper_sg_callback_t<Record>::value,
+                  "records must be proper scope_guard callbacks");
+
+  public:
+    typedef Record record_type;
+
+    failure_log() noexcept;
+    ~failure_log() noexcept; // emits the records oldest first, unless dismissed
+
+    template<typename R>
+    void record(R&& record)
+    noexcept(detail::is_nothrow_constructible<Record, R&&>::value);
+
+    void dismiss() noexcept; // drops the records without emitting them
+
+    detail::size_t size() const noexcept;
+    detail::size_t overwritten() const noexcept;
+
+  public:
+    failure_log(const failure_log&) = delete;
+    failure_log& operator=(const failure_log&) = delete;
+
+  private:
+    Record& slot(detail::size_t index) noexcept;
+    void drop() noexcept;
+
+  private:
+    alignas(Record) unsigned char m_slots[Capacity * sizeof(Record)];
+    detail::size_t m_next; // the slot to write next (the oldest, when full)
+    detail::size_t m_size;
+    detail::size_t m_overwritten;
+  };
+
+} // namespace sg
+
+////////////////////////////////////////////////////////////////////////////////
+inline void* operator new(sg::detail::size_t, void* where,
+                          sg::detail::placement_tag) /* not noexcept, so the
+                          result needs no null check */
+{
+  return where;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+inline void operator delete(void*, void*, sg::detail::placement_tag) noexcept
+{} // matches the above, in case a constructor throws
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Callback>
+sg::detail::scope_guard<Callback>::scope_guard(Callback&& callback)
+noexcept(is_nothrow_constructible<Callback, Callback&&>::value)
+  : m_callback(detail::forward<Callback>(callback)) /* use () instead of {}
+    because of DR 1467 (https://is.gd/WHmWuo), which still impacts older
+    compilers (e.g. GCC 4.x and clang <=3.6, see https://godbolt.org/g/TE9tPJ
+    and https://is.gd/Tsmh8G) */
+  , m_active{true}
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Callback>
+sg::detail::scope_guard<Callback>::scope_guard::~scope_guard() noexcept  /*
+need the extra injected-class-name here to make different compilers happy */
+{
+  if(m_active)
+    m_callback();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Callback>
+sg::detail::scope_guard<Callback>::scope_guard(scope_guard&& other)
+noexcept(is_nothrow_constructible<Callback, Callback&&>::value)
+  : m_callback(detail::forward<Callback>(other.m_callback)) // idem
+  , m_active{other.m_active}
+{
+  other.m_active = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Callback>
+inline void sg::detail::scope_guard<Callback>::dismiss() noexcept
+{
+  m_active = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Callback>
+inline auto sg::detail::make_scope_guard(Callback&& callback)
+noexcept(is_nothrow_constructible<Callback, Callback&&>::value)
+-> detail::scope_guard<Callback>
+{
+  return detail::scope_guard<Callback>{detail::forward<Callback>(callback)};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<sg::detail::size_t... I, typename Callback, typename... Args>
+template<typename C, typename... A>
+sg::detail::bound_callback<sg::detail::index_sequence<I...>, Callback, Args...>
+::bound_callback(C&& callback, A&&... args)
+noexcept(all_t<is_nothrow_constructible<Callback, C&&>::value,
+               is_nothrow_constructible<Args, A&&>::value...>::value)
+  : compressed_leaf<0, Callback>(detail::forward<C>(callback))
+  , compressed_leaf<I + 1, Args>(detail::forward<A>(args))...
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+template<sg::detail::size_t... I, typename Callback, typename... Args>
+inline void
+sg::detail::bound_callback<sg::detail::index_sequence<I...>, Callback, Args...>
+::operator()()
+noexcept(is_nothrow_void_bound_callable_t<Callback, void(Args...)>::value)
+{
+  compressed_leaf<0, Callback>::get()(compressed_leaf<I + 1, Args>::get()...);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Callback, typename Arg, typename... Args>
+inline auto sg::detail::make_scope_guard(Callback&& callback, Arg&& arg,
+                                         Args&&... args)
+noexcept(is_nothrow_bindable_t<Callback, Arg, Args...>::value)
+-> typename enable_if<
+     is_void_bound_callable_t<
+       Callback, void(typename decay<Arg>::type,
+                      typename decay<Args>::type...)>::value,
+     scope_guard<bound_callback_t<Callback, Arg, Args...>>>::type
+{
+  return detail::make_scope_guard(bound_callback_t<Callback, Arg, Args...>{
+    detail::forward<Callback>(callback),
+    detail::forward<Arg>(arg),
+    detail::forward<Args>(args)...});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Callback, typename Aggregator>
+sg::detail::recording_callback<Callback, Aggregator>::recording_callback(
+  Callback&& callback, Aggregator& aggregator)
+noexcept(is_nothrow_constructible<Callback, Callback&&>::value)
+  : m_callback(detail::forward<Callback>(callback)) // idem
+  , m_aggregator(aggregator)
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Callback, typename Aggregator>
+inline void sg::detail::recording_callback<Callback, Aggregator>::operator()()
+noexcept(is_nothrow_recordable_callback_t<Callback, Aggregator>::value)
+{
+  m_aggregator.record(m_callback());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename T>
+sg::detail::restore_callback<T>::restore_callback(T& variable)
+noexcept(is_nothrow_constructible<T, T&>::value)
+  : m_variable(variable)
+  , m_saved(variable) // idem
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename T>
+inline void sg::detail::restore_callback<T>::operator()()
+noexcept(is_nothrow_assignable_t<T&, T&&>::value)
+{
+  restore(is_skippable_restore_t<T>{});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename T>
+inline void sg::detail::restore_callback<T>::restore(true_type) noexcept
+{
+  /* the write is skipped when the value is unchanged, so that restoring does
+  not dirty a cache line (or a page) that other threads may be reading */
+  if(!(m_variable == m_saved))
+    m_variable = m_saved;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename T>
+inline void sg::detail::restore_callback<T>::restore(false_type)
+noexcept(is_nothrow_assignable_t<T&, T&&>::value)
+{
+  m_variable = static_cast<T&&>(m_saved); // the saved value is no longer needed
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Lockable>
+sg::detail::relock_callback<Lockable>::relock_callback(Lockable& lockable)
+noexcept
+  : m_lockable(lockable)
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Lockable>
+inline void sg::detail::relock_callback<Lockable>::operator()() noexcept
+{
+  m_lockable.lock();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Counter, typename Delta>
+sg::detail::publish_callback<Counter, Delta>::publish_callback(
+  Counter& counter, Delta& delta) noexcept
+  : m_counter(counter)
+  , m_delta(delta)
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Counter, typename Delta>
+inline void sg::detail::publish_callback<Counter, Delta>::operator()()
+noexcept(is_nothrow_batchable_t<Counter, Delta>::value)
+{
+  if(m_delta != Delta{}) // leave the counter's cache line alone if possible
+    m_counter.fetch_add(m_delta);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Depth, typename Callback>
+sg::detail::outermost_callback<Depth, Callback>::outermost_callback(
+  Depth& depth, Callback&& callback)
+noexcept(is_nothrow_constructible<Callback, Callback&&>::value)
+  : compressed_leaf<0, Callback>(detail::forward<Callback>(callback))
+  , m_depth(&depth)
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Depth, typename Callback>
+sg::detail::outermost_callback<Depth, Callback>::outermost_callback(
+  outermost_callback&& other)
+noexcept(is_nothrow_constructible<Callback, Callback&&>::value)
+  : compressed_leaf<0, Callback>(static_cast<Callback&&>(other.get()))
+  , m_depth(other.m_depth)
+{
+  other.m_depth = nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Depth, typename Callback>
+sg::detail::outermost_callback<Depth, Callback>::~outermost_callback() noexcept
+{
+  if(m_depth) // not invoked, so give the depth back without leaving
+    --*m_depth;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Depth, typename Callback>
+inline void sg::detail::outermost_callback<Depth, Callback>::operator()()
+noexcept(is_nothrow_void_bound_callable_t<Callback, void()>::value)
+{
+  auto& depth = *m_depth;
+  m_depth = nullptr; // given back here
+  if(--depth == Depth{})
+    compressed_leaf<0, Callback>::get()();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Generation>
+sg::detail::bump_callback<Generation>::bump_callback(Generation& generation)
+noexcept
+  : m_generation(&generation)
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Generation>
+sg::detail::bump_callback<Generation>::bump_callback(bump_callback&& other)
+noexcept
+  : m_generation(other.m_generation)
+{
+  other.m_generation = nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Generation>
+sg::detail::bump_callback<Generation>::~bump_callback() noexcept
+{
+  if(m_generation) // not invoked, so undo the entry bump
+    --*m_generation;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Generation>
+inline void sg::detail::bump_callback<Generation>::operator()()
+noexcept(is_nothrow_bumpable_t<Generation>::value)
+{
+  auto& generation = *m_generation;
+  m_generation = nullptr; // bumped here
+  ++generation;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Error, sg::detail::size_t Capacity>
+inline void sg::error_aggregator<Error, Capacity>::record(const Error& error)
+noexcept
+{
+  if(static_cast<bool>(error)) // only failures are recorded
+  {
+    if(m_size < Capacity)
+      m_errors[m_size++] = error;
+    ++m_failures; // including those that do not fit
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Error, sg::detail::size_t Capacity>
+inline void sg::error_aggregator<Error, Capacity>::clear() noexcept
+{
+  m_size = m_failures = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Error, sg::detail::size_t Capacity>
+inline auto sg::error_aggregator<Error, Capacity>::size() const noexcept
+-> detail::size_t
+{
+  return m_size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Error, sg::detail::size_t Capacity>
+inline auto sg::error_aggregator<Error, Capacity>::failures() const noexcept
+-> detail::size_t
+{
+  return m_failures;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Error, sg::detail::size_t Capacity>
+inline auto
+sg::error_aggregator<Error, Capacity>::operator[](detail::size_t i) const
+noexcept -> const Error&
+{
+  return m_errors[i];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Error, sg::detail::size_t Capacity>
+inline auto sg::error_aggregator<Error, Capacity>::begin() const noexcept
+-> const Error*
+{
+  return m_errors;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Error, sg::detail::size_t Capacity>
+inline auto sg::error_aggregator<Error, Capacity>::end() const noexcept
+-> const Error*
+{
+  return m_errors + m_size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Callback, typename Aggregator>
+inline auto sg::make_fallible_scope_guard(Callback&& callback,
+                                          Aggregator& errors)
+noexcept(detail::is_nothrow_constructible<Callback, Callback&&>::value)
+-> typename detail::enable_if<
+     detail::is_recordable_callback_t<Callback, Aggregator>::value,
+     detail::scope_guard<
+       detail::recording_callback<Callback, Aggregator>>>::type
+{
+  return detail::make_scope_guard(
+    detail::recording_callback<Callback, Aggregator>{
+      detail::forward<Callback>(callback), errors});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename T>
+inline auto sg::make_restore_guard(T& variable)
+noexcept(detail::is_nothrow_saveable_t<T>::value)
+-> typename detail::enable_if<
+     detail::is_restorable_t<T>::value,
+     detail::scope_guard<detail::restore_callback<T>>>::type
+{
+  return detail::make_scope_guard(detail::restore_callback<T>{variable});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename T, typename U>
+inline auto sg::make_override_guard(T& variable, U&& value)
+noexcept(detail::is_nothrow_saveable_t<T>::value &&
+         detail::is_nothrow_assignable_t<T&, U&&>::value)
+-> typename detail::enable_if<
+     detail::is_restorable_t<T>::value &&
+     detail::is_assignable_t<T&, U&&>::value,
+     detail::scope_guard<detail::restore_callback<T>>>::type
+{
+  auto guard = make_restore_guard(variable);
+  variable = detail::forward<U>(value); // restored by the guard if this throws
+  return guard;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Lockable>
+inline auto sg::make_unlock_guard(Lockable& lockable)
+noexcept(detail::is_nothrow_unlockable_t<Lockable>::value)
+-> typename detail::enable_if<
+     detail::is_basic_lockable_t<Lockable>::value,
+     detail::scope_guard<detail::relock_callback<Lockable>>>::type
+{
+  lockable.unlock();
+  return detail::make_scope_guard(detail::relock_callback<Lockable>{lockable});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Counter, typename Delta>
+inline auto sg::make_batch_guard(Counter& counter, Delta& delta) noexcept
+-> typename detail::enable_if<
+     detail::is_batchable_t<Counter, Delta>::value,
+     detail::scope_guard<detail::publish_callback<Counter, Delta>>>::type
+{
+  return detail::make_scope_guard(
+    detail::publish_callback<Counter, Delta>{counter, delta});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Depth, typename Enter, typename Leave>
+inline auto sg::make_outermost_guard(Depth& depth, Enter&& enter,
+                                     Leave&& leave)
+noexcept(detail::is_nothrow_outermost_t<Depth, Enter, Leave>::value)
+-> typename detail::enable_if<
+     detail::is_void_bound_callable_t<Enter, void()>::value &&
+     detail::is_proper_sg_callback_t<Leave>::value,
+     detail::scope_guard<detail::outermost_callback<Depth, Leave>>>::type
+{
+  typedef detail::outermost_callback<Depth, Leave> callback_type;
+  const auto outermost = depth == Depth{};
+  callback_type callback{depth, detail::forward<Leave>(leave)}; /* first, so
+                                          nothing has happened if this throws */
+  ++depth; // the callback gives it back if entering throws
+  if(outermost)
+    enter();
+
+  return detail::make_scope_guard(static_cast<callback_type&&>(callback));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Generation>
+inline auto sg::make_generation_guard(Generation& generation)
+noexcept(detail::is_nothrow_bumpable_t<Generation>::value)
+-> typename detail::enable_if<
+     detail::is_bumpable_t<Generation>::value,
+     detail::scope_guard<detail::bump_callback<Generation>>>::type
+{
+  ++generation; // under update, until the guard bumps it again or undoes this
+  return detail::make_scope_guard(
+    detail::bump_callback<Generation>{generation});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+constexpr auto sg::detail::cleanup_stack::aligned(size_t size) noexcept
+-> size_t
+{
+  return (size + alignof(max_align_t) - 1) / alignof(max_align_t) *
+         alignof(max_align_t);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+inline sg::detail::cleanup_stack::cleanup_stack(unsigned char* arena,
+                                                size_t capacity) noexcept
+  : m_arena{arena}
+  , m_capacity{capacity}
+  , m_used{0}
+  , m_last{nullptr}
+  , m_nontrivial{0}
+  , m_previous{current()}
+{
+  current() = this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+inline sg::detail::cleanup_stack::~cleanup_stack() noexcept
+{
+  current() = m_previous; /* first, so that cleanups deferring more cleanups
+                             reach the enclosing context instead of this one */
+  unwind(true);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+inline void sg::detail::cleanup_stack::dismiss() noexcept
+{
+  if(m_nontrivial) // otherwise, there is nothing to destroy
+    unwind(false);
+
+  m_used = m_nontrivial = 0;
+  m_last = nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+inline void sg::detail::cleanup_stack::unwind(bool invoke) noexcept
+{
+  for(auto entry = m_last; entry; entry = entry->m_previous)
+    entry->m_run(reinterpret_cast<unsigned char*>(entry) +
+                 aligned(sizeof(deferred_cleanup)), invoke);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Callback>
+inline bool sg::detail::cleanup_stack::push(Callback&& callback)
+noexcept(is_nothrow_constructible<typename decay<Callback>::type,
+                                  Callback&&>::value)
+{
+  typedef typename decay<Callback>::type callback_type;
+  static_assert(alignof(callback_type) <= alignof(max_align_t),
+                "over-aligned callbacks cannot be deferred");
+
+  constexpr auto header_size = aligned(sizeof(deferred_cleanup));
+  constexpr auto size = header_size + aligned(sizeof(callback_type));
+  if(m_capacity - m_used < size)
+    return false;
+
+  auto entry = m_arena + m_used;
+  ::new(static_cast<void*>(entry + header_size), placement_tag{})
+    callback_type(detail::forward<Callback>(callback)); // () as above
+  m_last = ::new(static_cast<void*>(entry), placement_tag{})
+    deferred_cleanup{&run<callback_type>, m_last}; // only once constructed
+  m_used += size;
+  if(!is_trivially_destructible<callback_type>::value)
+    ++m_nontrivial;
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+inline auto sg::detail::cleanup_stack::current() noexcept -> cleanup_stack*&
+{
+  static thread_local cleanup_stack* ambient = nullptr;
+  return ambient;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Callback>
+inline void sg::detail::cleanup_stack::run(void* callback, bool invoke)
+noexcept
+{
+  auto& cb = *static_cast<Callback*>(callback);
+  if(invoke)
+    cb();
+  cb.~Callback();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<sg::detail::size_t Bytes>
+sg::cleanup_context<Bytes>::cleanup_context() noexcept
+  : m_stack{m_arena, Bytes}
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+template<sg::detail::size_t Bytes>
+inline void sg::cleanup_context<Bytes>::dismiss() noexcept
+{
+  m_stack.dismiss();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Callback>
+inline auto sg::defer_to_request(Callback&& callback)
+noexcept(detail::is_nothrow_constructible<
+           typename detail::decay<Callback>::type, Callback&&>::value)
+-> typename detail::enable_if<
+     detail::is_proper_sg_callback_t<
+       typename detail::decay<Callback>::type>::value,
+     bool>::type
+{
+  auto stack = detail::cleanup_stack::current();
+  return stack && stack->push(detail::forward<Callback>(callback));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Record, sg::detail::size_t Capacity>
+sg::failure_log<Record, Capacity>::failure_log() noexcept
+  : m_next{0}
+  , m_size{0}
+  , m_overwritten{0}
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Record, sg::detail::size_t Capacity>
+sg::failure_log<Record, Capacity>::~failure_log() noexcept
+{
+  auto index = (m_next + Capacity - m_size) % Capacity; // the oldest
+  for(; m_size; --m_size, index = (index + 1) % Capacity)
+  {
+    auto& rec = slot(index);
+    rec();
+    rec.~Record();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Record, sg::detail::size_t Capacity>
+template<typename R>
+inline void sg::failure_log<Record, Capacity>::record(R&& record)
+noexcept(detail::is_nothrow_constructible<Record, R&&>::value)
+{
+  if(m_size == Capacity) // full, so the oldest record makes room
+  {
+    slot(m_next).~Record();
+    --m_size; // the ring now starts after m_next, even if what follows throws
+    ++m_overwritten;
+  }
+
+  ::new(static_cast<void*>(&slot(m_next)), detail::placement_tag{})
+    Record(detail::forward<R>(record)); // () as in scope_guard's constructor
+  m_next = (m_next + 1) % Capacity;
+  ++m_size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Record, sg::detail::size_t Capacity>
+inline void sg::failure_log<Record, Capacity>::dismiss() noexcept
+{
+  drop();
+  m_next = m_overwritten = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Record, sg::detail::size_t Capacity>
+inline auto sg::failure_log<Record, Capacity>::size() const noexcept
+-> detail::size_t
+{
+  return m_size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Record, sg::detail::size_t Capacity>
+inline auto sg::failure_log<Record, Capacity>::overwritten() const noexcept
+-> detail::size_t
+{
+  return m_overwritten;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Record, sg::detail::size_t Capacity>
+inline auto sg::failure_log<Record, Capacity>::slot(detail::size_t index)
+noexcept -> Record&
+{
+  return *reinterpret_cast<Record*>(m_slots + index * sizeof(Record));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template<typename Record, sg::detail::size_t Capacity>
+inline void sg::failure_log<Record, Capacity>::drop() noexcept
+{
+  if(!detail::is_trivially_destructible<Record>::value) // else nothing to do
+    for(auto index = (m_next + Capacity - m_size) % Capacity; m_size;
+        --m_size, index = (index + 1) % Capacity)
+      slot(index).~Record();
+
+  m_size = 0;
 }
 
 #endif /* SCOPE_GUARD_HPP_ */
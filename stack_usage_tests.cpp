@@ -0,0 +1,342 @@
+/*
+ * Stack usage tests, only built with ENABLE_STACK_USAGE (see docs/tests.md).
+ *
+ * For each callback category, a "direct" function creates the callback and
+ * invokes it by hand, while a "guarded" function hands the same callback to a
+ * scope_guard. Both pass the address of what they create to an opaque sink,
+ * so that it must live in their frames even when optimized. They are compiled
+ * with -fstack-usage and this program checks, from the resulting report, that
+ * the guarded frame is no larger than the direct one with the callback
+ * replaced by the guard (i.e. the callback plus its activity flag), rounded up
+ * to the stack alignment. The rounding applies to the total, because frame
+ * sizes include the return address and are therefore not multiples of the
+ * alignment themselves. When the guard holds the callback by reference, the
+ * direct function reports no callback size, since the callback stays in the
+ * guarded frame too.
+ */
+
+#include "scope_guard.hpp"
+
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+using namespace sg;
+
+/* --- first some test helpers --- */
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  unsigned count = 0u;
+  void incc(unsigned& c) noexcept { ++c; }
+  void inc() noexcept { incc(count); }
+
+  struct stateless_functor
+  {
+    void operator()() const noexcept { inc(); }
+  };
+
+  struct stateful_functor
+  {
+    explicit stateful_functor(unsigned& c) : m_c(c) {}
+    void operator()() const noexcept { incc(m_c); }
+
+    unsigned& m_c;
+  };
+
+  using fun_ptr = void(*)();
+
+  struct bound_incc // what a guard with bound arguments holds
+  {
+    void operator()() const noexcept { fun(arg); }
+
+    void (&fun)(unsigned&);
+    std::reference_wrapper<unsigned> arg;
+  };
+} // namespace
+
+/* --- representative uses, per callback category --- */
+
+// external linkage and no inlining, so that each function has its own frame
+// in the stack usage report
+#define SG_STACK_PROBE extern "C" __attribute__((noinline)) void
+
+/* An opaque use of an object, so that it must live in the frame that created
+it, instead of being optimized away (or kept in registers) along with the
+probe's body */
+extern "C" __attribute__((noinline)) void su_sink(const void* p)
+{
+  __asm__ __volatile__("" : : "r"(p) : "memory");
+}
+
+SG_STACK_PROBE su_direct_function(std::size_t& size)
+{
+  fun_ptr f = inc; // what the guard would hold
+  su_sink(&f);
+  size = sizeof(f);
+  f();
+}
+
+SG_STACK_PROBE su_guarded_function(std::size_t& size)
+{
+  auto guard = make_scope_guard(inc);
+  su_sink(&guard);
+  size = sizeof(guard);
+}
+
+SG_STACK_PROBE su_direct_function_pointer(std::size_t& size)
+{
+  fun_ptr f = inc;
+  su_sink(&f);
+  size = sizeof(f);
+  f();
+}
+
+SG_STACK_PROBE su_guarded_function_pointer(std::size_t& size)
+{
+  auto guard = make_scope_guard(fun_ptr{inc});
+  su_sink(&guard);
+  size = sizeof(guard);
+}
+
+SG_STACK_PROBE su_direct_std_function(std::size_t& size)
+{
+  std::function<void()> f{inc};
+  su_sink(&f);
+  size = 0; // the guarded variant keeps f too, and holds it by reference
+  f();
+}
+
+SG_STACK_PROBE su_guarded_std_function(std::size_t& size)
+{
+  std::function<void()> f{inc}; /* an rvalue would be moved into the guard,
+                                    leaving the moved-from temporary behind */
+  auto guard = make_scope_guard(f);
+  su_sink(&guard);
+  size = sizeof(guard);
+}
+
+SG_STACK_PROBE su_direct_lambda(std::size_t& size)
+{
+  auto f = []() noexcept { inc(); };
+  su_sink(&f);
+  size = sizeof(f);
+  f();
+}
+
+SG_STACK_PROBE su_guarded_lambda(std::size_t& size)
+{
+  auto guard = make_scope_guard([]() noexcept { inc(); });
+  su_sink(&guard);
+  size = sizeof(guard);
+}
+
+SG_STACK_PROBE su_direct_capturing_lambda(std::size_t& size)
+{
+  auto& c = count; // state the callback refers to, outside the frame
+  auto f = [&c]() noexcept { incc(c); };
+  su_sink(&f);
+  size = sizeof(f);
+  f();
+}
+
+SG_STACK_PROBE su_guarded_capturing_lambda(std::size_t& size)
+{
+  auto& c = count; // state the callback refers to, outside the frame
+  {
+    auto guard = make_scope_guard([&c]() noexcept { incc(c); });
+    su_sink(&guard);
+    size = sizeof(guard);
+  }
+}
+
+SG_STACK_PROBE su_direct_bound_function(std::size_t& size)
+{
+  auto f = std::bind(incc, std::ref(count));
+  su_sink(&f);
+  size = sizeof(f);
+  f();
+}
+
+SG_STACK_PROBE su_guarded_bound_function(std::size_t& size)
+{
+  auto guard = make_scope_guard(std::bind(incc, std::ref(count)));
+  su_sink(&guard);
+  size = sizeof(guard);
+}
+
+SG_STACK_PROBE su_direct_bound_arguments(std::size_t& size)
+{
+  auto& c = count; // state the callback refers to, outside the frame
+  bound_incc f{incc, std::ref(c)};
+  su_sink(&f);
+  size = sizeof(f);
+  f();
+}
+
+SG_STACK_PROBE su_guarded_bound_arguments(std::size_t& size)
+{
+  auto& c = count; // state the callback refers to, outside the frame
+  {
+    auto guard = make_scope_guard(incc, std::ref(c));
+    su_sink(&guard);
+    size = sizeof(guard);
+  }
+}
+
+SG_STACK_PROBE su_direct_stateless_functor(std::size_t& size)
+{
+  stateless_functor f{};
+  su_sink(&f);
+  size = sizeof(f);
+  f();
+}
+
+SG_STACK_PROBE su_guarded_stateless_functor(std::size_t& size)
+{
+  auto guard = make_scope_guard(stateless_functor{});
+  su_sink(&guard);
+  size = sizeof(guard);
+}
+
+SG_STACK_PROBE su_direct_stateful_functor(std::size_t& size)
+{
+  auto& c = count; // state the callback refers to, outside the frame
+  stateful_functor f{c};
+  su_sink(&f);
+  size = sizeof(f);
+  f();
+}
+
+SG_STACK_PROBE su_guarded_stateful_functor(std::size_t& size)
+{
+  auto& c = count; // state the callback refers to, outside the frame
+  {
+    auto guard = make_scope_guard(stateful_functor{c});
+    su_sink(&guard);
+    size = sizeof(guard);
+  }
+}
+
+#undef SG_STACK_PROBE
+
+/* --- reading the stack usage report --- */
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  constexpr auto stack_alignment = alignof(std::max_align_t);
+
+  struct category
+  {
+    const char* name;
+    void (*direct)(std::size_t&);
+    void (*guarded)(std::size_t&);
+  };
+
+  const category categories[] = {
+    {"function", su_direct_function, su_guarded_function},
+    {"function_pointer", su_direct_function_pointer,
+                         su_guarded_function_pointer},
+    {"std_function", su_direct_std_function, su_guarded_std_function},
+    {"lambda", su_direct_lambda, su_guarded_lambda},
+    {"capturing_lambda", su_direct_capturing_lambda,
+                         su_guarded_capturing_lambda},
+    {"bound_function", su_direct_bound_function, su_guarded_bound_function},
+    {"bound_arguments", su_direct_bound_arguments,
+                        su_guarded_bound_arguments},
+    {"stateless_functor", su_direct_stateless_functor,
+                          su_guarded_stateless_functor},
+    {"stateful_functor", su_direct_stateful_functor,
+                         su_guarded_stateful_functor},
+  };
+
+  std::size_t round_up(std::size_t n, std::size_t alignment)
+  {
+    return (n + alignment - 1) / alignment * alignment;
+  }
+
+  /* Find the frame size of the function with the given name in a stack usage
+  report. Each line in the report has the form
+  "file:line:col:function<TAB>bytes<TAB>qualifiers", where GCC decorates the
+  function name with its signature, while Clang uses the plain (extern "C")
+  symbol. Returns false if the function is not found. */
+  bool frame_size(const std::string& report, const std::string& function,
+                  std::size_t& bytes)
+  {
+    std::ifstream in{report};
+    std::string line;
+    while(std::getline(in, line))
+    {
+      const auto tab = line.find('\t');
+      const auto pos = line.find(function);
+      if(tab == std::string::npos || pos == std::string::npos || pos == 0 ||
+         pos + function.size() > tab)
+        continue;
+
+      const auto before = line[pos - 1];
+      const auto after = line[pos + function.size()];
+      if((before == ' ' || before == ':') && (after == '(' || after == '\t'))
+      {
+        bytes = std::stoul(line.substr(tab + 1));
+        return true;
+      }
+    }
+
+    return false;
+  }
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  if(argc != 2)
+  {
+    std::cerr << "usage: " << argv[0] << " <stack usage report (.su)>\n";
+    return 2;
+  }
+
+  auto ok = true;
+  std::cout << std::left << std::setw(20) << "category"
+            << std::right << std::setw(8) << "direct"
+            << std::setw(9) << "guarded"
+            << std::setw(7) << "callbk"
+            << std::setw(7) << "guard"
+            << std::setw(9) << "allowed" << "\n";
+
+  for(const auto& cat : categories)
+  {
+    auto callback_size = std::size_t{0};
+    auto guard_size = std::size_t{0};
+    cat.direct(callback_size);
+    cat.guarded(guard_size);
+
+    auto direct = std::size_t{0};
+    auto guarded = std::size_t{0};
+    const auto name = std::string{cat.name};
+    if(!frame_size(argv[1], "su_direct_" + name, direct) ||
+       !frame_size(argv[1], "su_guarded_" + name, guarded))
+    {
+      std::cerr << "no stack usage found for " << name << "\n";
+      return 2;
+    }
+
+    const auto allowed = round_up(direct - callback_size + guard_size,
+                                  stack_alignment); // see the top of the file
+    const auto cat_ok = guarded <= allowed;
+    ok = ok && cat_ok;
+
+    std::cout << std::left << std::setw(20) << name
+              << std::right << std::setw(8) << direct
+              << std::setw(9) << guarded
+              << std::setw(7) << callback_size
+              << std::setw(7) << guard_size
+              << std::setw(9) << allowed
+              << (cat_ok ? "" : "  <-- exceeded") << "\n";
+  }
+
+  return ok ? 0 : 1;
+}
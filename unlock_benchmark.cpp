@@ -0,0 +1,161 @@
+/*
+ * Lock hold time benchmark, only built with ENABLE_BENCHMARKS (see
+ * docs/tests.md).
+ *
+ * Producers and consumers share a queue behind a single mutex. Each consumer
+ * pops an item, does some slow work on it and publishes the result, all
+ * within one critical section. This runs twice: first holding the lock
+ * throughout, then dropping it around the slow work with an unlock guard. The
+ * total time the mutex is held and the wall time are reported for both, and
+ * the program fails if the unlock guard does not reduce the hold time (or if
+ * the two runs do not agree on the result).
+ */
+
+#include "scope_guard.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace sg;
+
+/* --- first some helpers --- */
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+  using bench_clock = std::chrono::steady_clock;
+
+  constexpr auto producers = 2;
+  constexpr auto consumers = 4;
+  constexpr auto items_per_producer = 2000;
+  constexpr auto work_rounds = 20000u;
+
+  // A mutex that accumulates the time during which it is held
+  class timed_mutex
+  {
+  public:
+    void lock()
+    {
+      m_mutex.lock();
+      m_since = bench_clock::now();
+    }
+
+    void unlock()
+    {
+      m_held += bench_clock::now() - m_since;
+      m_mutex.unlock();
+    }
+
+    bench_clock::duration held() const noexcept { return m_held; }
+
+  private:
+    std::mutex m_mutex;
+    bench_clock::time_point m_since;
+    bench_clock::duration m_held{};
+  };
+
+  // Something slow that needs no shared state
+  std::uint64_t slow_work(std::uint64_t item) noexcept
+  {
+    for(auto i = 0u; i < work_rounds; ++i)
+      item = item * 6364136223846793005u + 1442695040888963407u;
+    return item;
+  }
+
+  struct result
+  {
+    bench_clock::duration held;
+    bench_clock::duration wall;
+    std::uint64_t checksum;
+  };
+
+  result run(bool unlock_around_work)
+  {
+    timed_mutex mutex;
+    std::condition_variable_any ready;
+    std::deque<std::uint64_t> queue;
+    auto remaining = producers * items_per_producer;
+    auto checksum = std::uint64_t{0};
+
+    const auto start = bench_clock::now();
+
+    std::vector<std::thread> threads;
+    for(auto p = 0; p < producers; ++p)
+      threads.emplace_back([&, p]
+      {
+        for(auto i = 0; i < items_per_producer; ++i)
+        {
+          const auto item = p * items_per_producer + i;
+          std::lock_guard<timed_mutex> lock{mutex};
+          queue.push_back(static_cast<std::uint64_t>(item));
+          ready.notify_one();
+        }
+      });
+
+    for(auto c = 0; c < consumers; ++c)
+      threads.emplace_back([&]
+      {
+        std::unique_lock<timed_mutex> lock{mutex};
+        for(;;)
+        {
+          ready.wait(lock, [&] { return !queue.empty() || !remaining; });
+          if(!remaining)
+            break;
+
+          const auto item = queue.front();
+          queue.pop_front();
+          --remaining;
+
+          auto value = std::uint64_t{0};
+          if(unlock_around_work)
+          {
+            const auto guard = make_unlock_guard(lock);
+            value = slow_work(item);
+          } // locked again here, even if slow_work threw
+          else
+            value = slow_work(item);
+
+          checksum ^= value;
+          if(!remaining)
+            ready.notify_all();
+        }
+      });
+
+    for(auto& t : threads)
+      t.join();
+
+    return {mutex.held(), bench_clock::now() - start, checksum};
+  }
+
+  double ms(bench_clock::duration d)
+  {
+    return std::chrono::duration<double, std::milli>(d).count();
+  }
+} // namespace
+
+int main()
+{
+  const auto held_throughout = run(false);
+  const auto unlocked_around = run(true);
+
+  std::cout << std::left << std::setw(24) << "variant"
+            << std::right << std::setw(14) << "held (ms)"
+            << std::setw(14) << "wall (ms)" << "\n"
+            << std::fixed << std::setprecision(1)
+            << std::left << std::setw(24) << "held throughout"
+            << std::right << std::setw(14) << ms(held_throughout.held)
+            << std::setw(14) << ms(held_throughout.wall) << "\n"
+            << std::left << std::setw(24) << "unlock guard"
+            << std::right << std::setw(14) << ms(unlocked_around.held)
+            << std::setw(14) << ms(unlocked_around.wall) << "\n";
+
+  return unlocked_around.checksum == held_throughout.checksum &&
+         unlocked_around.held < held_throughout.held ? 0 : 1;
+}